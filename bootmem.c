@@ -0,0 +1,215 @@
+/*
+ * Copyright (C) 2013 - Simone Rotondo - http://www.piemontewireless.net/
+ * simOS - tiny x86 kernel
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Early boot memory: a bump allocator on the memory mapped by boot.S after
+// the kernel image, used before the buddy allocator exists. The allocations
+// and the fixed reservations (kernel image, BIOS area, loader data) are tracked as a few
+// regions, adjacent ones being merged, and bootmem__handover() gives them
+// to the frame allocator in one go (no per-frame work here).
+
+// standard includes
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// simOS includes
+#include "utils.h"
+#include "kassert.h"
+#include "console.h"
+#include "mem.h"
+#include "bootmem.h"
+
+
+
+/* ====== Globals ====== */
+
+uint32_t bootmem_start;                 // arena start (physical)
+uint32_t bootmem_top;                   // next free byte of the arena (physical)
+uint32_t bootmem_limit;                 // arena end (physical)
+bool bootmem_done;                      // the regions have been handed over
+
+bootmem_region_t bootmem_regions[BOOTMEM_MAX_REGIONS];  // in reservation order
+uint32_t nb_bootmem_regions;
+
+
+
+/* ====== PRIVATE bootmem functions ====== */
+
+// Record a region, it is merged with the last one when they have the same
+// state and the new one starts in the last page of the other
+static void __region_add(uint32_t start, uint32_t end, frame_state_t state)
+{
+    bootmem_region_t *last;
+
+    if (start == end)
+        return;
+
+    if (nb_bootmem_regions > 0) {
+        last = &bootmem_regions[nb_bootmem_regions-1];
+        if ((last->state == state) && (start >= last->start) && (start <= ALIGN_PAGE(last->end))) {
+            if (end > last->end)
+                last->end = end;
+            return;
+        }
+    }
+
+    KASSERT(nb_bootmem_regions < BOOTMEM_MAX_REGIONS);
+    bootmem_regions[nb_bootmem_regions].start = start;
+    bootmem_regions[nb_bootmem_regions].end = end;
+    bootmem_regions[nb_bootmem_regions].state = state;
+    nb_bootmem_regions++;
+}
+
+
+// Cut [start, end) out of the regions (a region can be split in two)
+static void __region_cut(uint32_t start, uint32_t end)
+{
+    bootmem_region_t *r;
+    uint32_t i;
+
+    for (i=0; i<nb_bootmem_regions; i++) {
+        r = &bootmem_regions[i];
+        if ((end <= r->start) || (start >= r->end))
+            continue;
+
+        if ((start > r->start) && (end < r->end)) {
+            // hole in the middle: the upper part becomes a new region
+            KASSERT(nb_bootmem_regions < BOOTMEM_MAX_REGIONS);
+            memmove(r + 2, r + 1, (nb_bootmem_regions - i - 1) * sizeof(bootmem_region_t));
+            r[1].start = end;
+            r[1].end = r->end;
+            r[1].state = r->state;
+            r->end = start;
+            nb_bootmem_regions++;
+            i++;
+        }
+        else if (start > r->start) {
+            r->end = start;
+        }
+        else if (end < r->end) {
+            r->start = end;
+        }
+        else {
+            r->start = r->end;          // empty, skipped by the handover
+        }
+    }
+}
+
+
+
+/* ====== PUBLIC bootmem functions ====== */
+
+// Set up the arena on the physical memory [start, limit) (direct mapped by boot.S)
+void bootmem__init(uint32_t start, uint32_t limit)
+{
+    bootmem_start = bootmem_top = start;
+    bootmem_limit = limit;
+    bootmem_done = false;
+    nb_bootmem_regions = 0;
+}
+
+
+// Allocate size bytes aligned on align (a power of 2), the memory is not cleared
+// arg3: state of the frames once handed over
+// ret: direct map address (the system is halted when the arena is full)
+void *bootmem__alloc(uint32_t size, uint32_t align, frame_state_t state)
+{
+    bootmem_region_t *r;
+    uint32_t addr, i;
+    bool moved;
+
+    KASSERT(!bootmem_done);
+
+    addr = ALIGN(bootmem_top, align);
+
+    // step over the fixed reservations in the arena (loader data), by whole
+    // pages: the allocations are all below bootmem_top
+    do {
+        moved = false;
+        for (i=0; i<nb_bootmem_regions; i++) {
+            r = &bootmem_regions[i];
+            if ((r->end > bootmem_top) && (addr < ALIGN_PAGE(r->end)) && (addr + size > (r->start & PAGE_MASK))) {
+                addr = ALIGN(ALIGN_PAGE(r->end), align);
+                moved = true;
+            }
+        }
+    } while (moved && (addr >= bootmem_top));
+    if ((addr < bootmem_top) || (addr + size > bootmem_limit) || (addr + size < addr)) {
+        console__printf("Fatal Error [Out of memory]: boot arena full (%d bytes)\n", size);
+        HALT();
+    }
+
+    bootmem_top = addr + size;
+    __region_add(addr, addr + size, state);
+
+    return (void *) PHYS_TO_VIRT(addr);
+}
+
+
+// Give back a boot allocation that does not have to survive the boot:
+// the arena shrinks if it is the last one, else its pages are left out of the handover
+void bootmem__free(void *ptr, uint32_t size)
+{
+    uint32_t addr;
+
+    KASSERT(!bootmem_done);
+
+    addr = VIRT_TO_PHYS(ptr);
+    KASSERT((addr >= bootmem_start) && (addr + size <= bootmem_top));
+
+    if (addr + size == bootmem_top)
+        bootmem_top = addr;
+    __region_cut(addr, addr + size);
+}
+
+
+// Reserve a fixed physical region (the arena allocations step over it)
+void bootmem__reserve(uint32_t start, uint32_t len, frame_state_t state)
+{
+    KASSERT(!bootmem_done);
+    __region_add(start, start + len, state);
+}
+
+
+// Hand the regions over to the frame allocator, in reservation order
+// (a later region wins on overlaps): the arena is closed
+void bootmem__handover(void (*reserve)(uint32_t start, uint32_t len, frame_state_t state))
+{
+    uint32_t i;
+
+    KASSERT(!bootmem_done);
+    bootmem_done = true;
+
+    for (i=0; i<nb_bootmem_regions; i++) {
+        if (bootmem_regions[i].start < bootmem_regions[i].end)
+            reserve(bootmem_regions[i].start, bootmem_regions[i].end - bootmem_regions[i].start,
+                    bootmem_regions[i].state);
+    }
+}
+
+
+void bootmem__dump(void)
+{
+    uint32_t i;
+
+    console__printf("Boot arena: 0x%x - 0x%x (%d Kb used)\n",
+                    bootmem_start, bootmem_limit, (bootmem_top - bootmem_start) / 1024);
+    for (i=0; i<nb_bootmem_regions; i++)
+        console__printf("Region[%d] 0x%x - 0x%x state=%d\n", i,
+                        bootmem_regions[i].start, bootmem_regions[i].end, bootmem_regions[i].state);
+}
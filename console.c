@@ -124,7 +124,7 @@ void console__initialize()
     console_row = 0;
     console_column = 0;
     console_color = __make_color(COLOR_LIGHT_GREY, COLOR_BLACK);
-    console_buffer = (uint16_t*) 0xB8000;
+    console_buffer = (uint16_t*) VGA_VIDEOMEM;
     for ( size_t y = 0; y < VGA_NUMROWS; y++ )
     {
         for ( size_t x = 0; x < VGA_NUMCOLS; x++ )
@@ -0,0 +1,139 @@
+/*
+ * Copyright (C) 2013 - Simone Rotondo - http://www.piemontewireless.net/
+ * simOS - tiny x86 kernel
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Contiguous DMA buffers: a bitmap allocator (one bit per page) on the
+// DMA region reserved by mem__paging_init(). Buffers are page aligned,
+// so they are cache aligned, and physically contiguous.
+
+// standard includes
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// simOS includes
+#include "utils.h"
+#include "kassert.h"
+#include "console.h"
+#include "mem.h"
+#include "int.h"
+#include "dma.h"
+
+
+
+/* ====== Globals ====== */
+
+uint32_t *dma_map;                      // Used pages bitmap (in the first pages of the region)
+uint32_t  dma_first;                    // First frame of the buffers
+uint32_t  dma_npages;                   // Number of pages for the buffers
+uint32_t  dma_nfree;                    // Number of free pages
+uint32_t  dma_next;                     // Where the next search starts (next fit)
+
+
+
+/* ====== PUBLIC dma functions ====== */
+
+void dma__init(void)
+{
+    uint32_t nframes, map_pages;
+
+    dma_map = NULL;
+    dma_first = dma_npages = dma_nfree = dma_next = 0;
+
+    nframes = dma_region.end - dma_region.start;
+    if (nframes < 2)
+        return;
+
+    // the bitmap takes the first pages of the region
+    map_pages = (((nframes + 31) / 32) * sizeof(uint32_t) + PAGE_SIZE-1) / PAGE_SIZE;
+
+    dma_map = (uint32_t *) FRAME_TO_VIRT(&kframelist[dma_region.start]);
+    dma_first = dma_region.start + map_pages;
+    dma_npages = nframes - map_pages;
+    dma_nfree = dma_npages;
+    memset(dma_map, 0, map_pages * PAGE_SIZE);
+}
+
+
+// Allocate a physically contiguous buffer of npages pages
+// arg2: set to the physical address of the buffer
+// ret: the kernel address of the buffer or NULL if there is no room
+void *dma__alloc(uint32_t npages, phys_addr_t *paddr)
+{
+    uint32_t state;
+    uint32_t page;
+
+    if ((npages == 0) || (npages > dma_npages))
+        return NULL;
+
+    state = int__irqsave();
+
+    if (npages > dma_nfree) {
+        int__irqrestore(state);
+        return NULL;
+    }
+
+    page = bitmap_find_free(dma_map, dma_next, dma_npages, npages);
+    if (page == dma_npages)
+        page = bitmap_find_free(dma_map, 0, dma_npages, npages);
+
+    if (page == dma_npages) {
+        int__irqrestore(state);
+        return NULL;
+    }
+
+    bitmap_set(dma_map, page, npages);
+    dma_nfree -= npages;
+    dma_next = (page + npages < dma_npages) ? page + npages : 0;
+
+    int__irqrestore(state);
+
+    *paddr = FRAME_TO_PHYS(&kframelist[dma_first + page]);
+    return FRAME_TO_VIRT(&kframelist[dma_first + page]);
+}
+
+
+// Free a buffer obtained with dma__alloc()
+void dma__free(void *vaddr, uint32_t npages)
+{
+    uint32_t state;
+    uint32_t page;
+    uint32_t i;
+
+    page = FRAME_INDEX(VIRT_TO_FRAME(vaddr)) - dma_first;
+    KASSERT(((uint32_t)vaddr & ~PAGE_MASK) == 0);
+    KASSERT(page + npages <= dma_npages);
+
+    state = int__irqsave();
+
+    for (i=page; i<page+npages; i++)
+        KASSERT(bitmap_test(dma_map, i));
+
+    bitmap_clear(dma_map, page, npages);
+    dma_nfree += npages;
+
+    int__irqrestore(state);
+}
+
+
+void dma__dump(void)
+{
+    console__printf("DMA region: 0x%x - 0x%x, %d/%d pages free\n",
+                    (uint32_t)FRAME_TO_PHYS(&kframelist[dma_region.start]),
+                    (uint32_t)FRAME_TO_PHYS(&kframelist[dma_region.end]),
+                    dma_nfree, dma_npages);
+}
@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2013 - Simone Rotondo - http://www.piemontewireless.net/
+ * simOS - tiny x86 kernel
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SIMOS_BOOTMEM_H
+#define SIMOS_BOOTMEM_H
+
+// standard includes
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// simOS includes
+#include "mem.h"
+
+
+
+#define BOOTMEM_MAX_REGIONS 32              // max number of reserved regions before the buddy allocator
+
+
+// typed allocation of n objects (kernel data, FRAME_KUSED)
+#define BOOTMEM_ALLOC(type, n)  ((type *) bootmem__alloc((n) * sizeof(type), __alignof__(type), FRAME_KUSED))
+
+
+// reserved physical region [start, end) (bytes)
+typedef struct bootmem_region {
+  uint32_t start;
+  uint32_t end;
+  frame_state_t state;
+} bootmem_region_t;
+
+
+
+/* PUBLIC bootmem functions */
+void bootmem__init(uint32_t start, uint32_t limit);
+void *bootmem__alloc(uint32_t size, uint32_t align, frame_state_t state);
+void bootmem__free(void *ptr, uint32_t size);
+void bootmem__reserve(uint32_t start, uint32_t len, frame_state_t state);
+void bootmem__handover(void (*reserve)(uint32_t start, uint32_t len, frame_state_t state));
+void bootmem__dump(void);
+
+
+#endif /* SIMOS_BOOTMEM_H */
@@ -27,7 +27,7 @@
 
 
 // VGA defines
-#define VGA_VIDEOMEM 0xB8000
+#define VGA_VIDEOMEM 0xC00B8000       // physical 0xB8000 in the kernel direct map
 #define VGA_NUMCOLS 80
 #define VGA_NUMROWS 25
 #define VGA_BYTES_PER_ROW (VGA_NUMCOLS * 2)
@@ -0,0 +1,39 @@
+/*
+ * Copyright (C) 2013 - Simone Rotondo - http://www.piemontewireless.net/
+ * simOS - tiny x86 kernel
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SIMOS_DMA_H
+#define SIMOS_DMA_H
+
+// standard includes
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// simOS includes
+#include "mem.h"
+
+
+
+/* PUBLIC dma functions */
+void dma__init(void);
+void *dma__alloc(uint32_t npages, phys_addr_t *paddr);
+void dma__free(void *vaddr, uint32_t npages);
+void dma__dump(void);
+
+
+#endif /* SIMOS_DMA_H */
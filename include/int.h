@@ -45,6 +45,10 @@
 #define REG_SS           (15)  /* "    " "" "     " "" "       " "        " */
 
 
+// Interrupt controller
+#define CONFIG_X86_APIC         1       // use the local APIC and the I/O APIC when the cpu has an APIC
+
+
 // Programmable Interrupt Controller (PIC)
 #define PIC_MASTER_CMD          0x20
 #define PIC_MASTER_DATA         0x21
@@ -65,6 +69,29 @@
 #define PIC_SLAVE_MASK          0xFF
 
 
+// Local APIC (xAPIC: memory mapped registers)
+#define MSR_APIC_BASE           0x1B
+#define MSR_APIC_BASE_ENABLE    (1 << 11)
+#define LAPIC_ID                0x020
+#define LAPIC_TPR               0x080   // task priority: vectors of class (vector >> 4) <= TPR are held back
+// The default vector of an irq is its number: IRQ0-15 are priority class 2, IRQ16-23 class 3.
+// int__irq_set_priority() moves a line to a priority vector of a higher class.
+#define LAPIC_EOI               0x0B0
+#define LAPIC_SVR               0x0F0   // spurious vector register
+#define LAPIC_SVR_ENABLE        0x100
+
+
+// I/O APIC
+#define IOAPIC_BASE             0xFEC00000
+#define IOAPIC_REGSEL           0x00
+#define IOAPIC_WIN              0x10
+#define IOAPIC_VER              0x01
+#define IOAPIC_REDTBL(pin)      (0x10 + 2 * (pin))
+#define IOAPIC_MASKED           (1 << 16)
+#define IOAPIC_LEVEL            (1 << 15)
+#define IOAPIC_ACTIVE_LOW       (1 << 13)
+
+
 // FLAGS bits
 #define X86_FLAGS_CF            (1 << 0)  /* Bit 0:  Carry Flag */
                                           /* Bit 1:  Reserved */
@@ -84,7 +111,7 @@
                                           /* Bit 15: Reserved */
 
 
-#define IDT_ENTRIES 0xFF            // number of IDT entries
+#define IDT_ENTRIES 0xFF            // last IDT entry
 #define DEF_INTGATE_FLAGS 0x8E      // P=1 DPL=0 (interrupt gate descriptor)
 
 
@@ -113,9 +140,41 @@ idtr_t;
 
 
 // IRQ vector function type
+//   context is NULL for an irq replayed by int__enable_irq() (not from the entry stub)
 typedef void (*irqvfunc_t)(uint8_t irq, uint32_t *context);
 
 
+// bit of an irq in the irq masks
+#define IRQ_BIT(irq)            (1 << ((irq) - IRQ0))
+
+
+// Per vector interrupt statistics (CONFIG_IRQ_STATS, in TSC cycles)
+//   latency: from the entry stub to the handler (latency_count samples, replays have none)
+//   hist: log2 histogram of the handler duration
+#define IRQ_HIST_BUCKETS        32
+
+typedef struct irq_stats {
+  uint32_t count;
+  uint64_t cycles;
+  uint32_t max_cycles;
+  uint64_t latency;
+  uint32_t latency_count;
+  uint32_t max_latency;
+  uint32_t hist[IRQ_HIST_BUCKETS];
+} irq_stats_t;
+
+
+// Interrupt controller operations (8259 PIC or local APIC + I/O APIC)
+//   irq numbers are the vectors IRQ0..IRQ0+NR_HW_IRQS-1
+typedef struct irq_chip {
+  const char *name;
+  void (*init)(void);
+  void (*eoi)(uint8_t irq);
+  void (*mask)(uint8_t irq);
+  void (*unmask)(uint8_t irq);
+} irq_chip_t;
+
+
 
 //  Interrupt Vectors
 extern void vector_isr0(void);
@@ -166,6 +225,16 @@ extern void vector_irq12(void);
 extern void vector_irq13(void);
 extern void vector_irq14(void);
 extern void vector_irq15(void);
+extern void vector_irq16(void);
+extern void vector_irq17(void);
+extern void vector_irq18(void);
+extern void vector_irq19(void);
+extern void vector_irq20(void);
+extern void vector_irq21(void);
+extern void vector_irq22(void);
+extern void vector_irq23(void);
+extern void vector_spurious(void);
+extern void vector_prio(void);
 
 
 
@@ -174,6 +243,11 @@ void int__idt_init(void);
 void int__irq_attach(uint8_t irq, irqvfunc_t isr);
 void int__enable_irq(uint8_t irq);
 void int__disable_irq(uint8_t irq);
+const char *int__chip_name(void);
+void int__set_priority(uint8_t class);
+bool int__irq_set_priority(uint8_t irq, uint8_t class);
+uint8_t int__get_priority(void);
+void int__dump_stats(void);
 uint32_t int__irqflags();
 bool int__irqdisabled(uint32_t flags);
 bool int__irqenabled(uint32_t flags);
@@ -20,6 +20,10 @@
 #define SIMOS_INTVECT_H
 
 
+/* Interrupt statistics (per vector count, cycles and latency), needs a cpu with TSC */
+#define CONFIG_IRQ_STATS 1
+
+
 
 /* ISR and IRQ numbers */
 
@@ -72,7 +76,24 @@
 #define IRQ13   45 /* Math coprocessor */
 #define IRQ14   46 /* Primary ATA channel */
 #define IRQ15   47 /* Secondary ATA channel */
+#define IRQ16   48 /* I/O APIC only: PCI interrupt lines */
+#define IRQ17   49
+#define IRQ18   50
+#define IRQ19   51
+#define IRQ20   52
+#define IRQ21   53
+#define IRQ22   54
+#define IRQ23   55
+
+#define NR_IRQS 56
+#define NR_HW_IRQS   (NR_IRQS - IRQ0)   /* interrupt controller lines */
+
+#define IRQ_SPURIOUS 0xFF /* Local APIC spurious interrupt (no EOI) */
 
-#define NR_IRQS 48
+/* Priority vectors (APIC): an irq moved to the priority class c gets a vector in [c*16, c*16+16) */
+#define IRQ_PRIO_VECTOR_FIRST   0x40    /* class 4, above the default vectors */
+#define IRQ_PRIO_VECTOR_END     0xF0    /* class 15 is left to the spurious vector */
+#define NR_PRIO_VECTORS         (IRQ_PRIO_VECTOR_END - IRQ_PRIO_VECTOR_FIRST)
+#define IRQ_PRIO_STUB_SIZE      16      /* bytes of each stub in vector_prio */
 
 #endif /* SIMOS_INTVECT_H */
@@ -32,5 +32,8 @@ do { \
         } \
 } while (0)
 
+// utlist.h list macros check their arguments with assert()
+#define assert(exp) KASSERT(exp)
+
 
 #endif /* SIMOS_KASSERT_H */
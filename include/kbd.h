@@ -27,6 +27,7 @@
 
 // keyboard defines
 #define KBD_IRQ        0x01
+#define KBD_RING_SIZE  64               // scancodes waiting for the bottom half (power of 2)
 
 #define STATUS_PORT    0x64
 #define KBD_OUT_BUF    0x60
@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2013 - Simone Rotondo - http://www.piemontewireless.net/
+ * simOS - tiny x86 kernel
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SIMOS_KMEM_H
+#define SIMOS_KMEM_H
+
+// standard includes
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+
+// kmem defines
+#define CACHE_LINE_SIZE         64              // cpu cache line size
+#define KMEM_SLAB_MIN_OBJS      8               // a slab grows (up to KMEM_SLAB_MAX_ORDER) to hold at least this objects
+#define KMEM_SLAB_MAX_ORDER     3               // max order of the frame block of a slab
+
+#define KMALLOC_MIN_SHIFT       3               // smallest kmalloc object: 2^3 = 8 bytes
+#define KMALLOC_MAX_SHIFT       11              // biggest kmalloc object: 2^11 = 2048 bytes
+#define KMALLOC_MAX_SIZE        (1 << KMALLOC_MAX_SHIFT)
+#define KMALLOC_NR_CACHES       (KMALLOC_MAX_SHIFT - KMALLOC_MIN_SHIFT + 1)
+
+
+// cache flags
+#define KMEM_HWCACHE_ALIGN      0x01            // align objects on cpu cache lines
+
+
+
+// slab struct, placed at the beginning of its frame block
+//   free objects are chained through their first word starting from freelist
+typedef struct kmem_slab {
+  struct kmem_cache *cache;
+  struct kmem_slab *next, *prev;
+  void *freelist;
+  uint32_t inuse;
+} kmem_slab_t;
+
+
+// object cache struct
+typedef struct kmem_cache {
+  const char *name;
+  uint32_t objsize;                             // object size requested at creation
+  uint32_t size;                                // object size including padding
+  uint32_t order;                               // order of the frame block of each slab
+  uint32_t nobjs;                               // objects per slab
+  uint32_t offset;                              // offset of the first object in the slab
+  uint32_t flags;
+  kmem_slab_t *slabs_partial;
+  kmem_slab_t *slabs_full;
+  kmem_slab_t *slabs_free;
+  struct kmem_cache *next, *prev;
+} kmem_cache_t;
+
+
+
+/* PUBLIC kmem functions */
+void kmem__init(void);
+kmem_cache_t *kmem__cache_create(const char *name, uint32_t size, uint32_t flags);
+void kmem__cache_destroy(kmem_cache_t *cache);
+void *kmem__cache_alloc(kmem_cache_t *cache);
+void kmem__cache_free(kmem_cache_t *cache, void *obj);
+void kmem__dump_caches(void);
+void *kmalloc(size_t size);
+void kfree(void *obj);
+
+
+#endif /* SIMOS_KMEM_H */
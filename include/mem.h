@@ -20,12 +20,28 @@
 #define SIMOS_MEM_H
 
 // standard includes
+#ifndef ASM
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#endif
 
 
 
+// Configuration defines
+#define CONFIG_PAGING_PAE   1                   // 3 levels paging with 64 bits entries (memory above 4Gb, up to about 28Gb), needs a PAE cpu
+#define CONFIG_PAGING_PSE   1                   // map physical memory with 4Mb pages when the cpu has PSE (always on with PAE)
+#define CONFIG_PAGING_PGE   1                   // mark kernel mappings global when the cpu has PGE
+#define ZERO_POOL_SIZE      64                  // number of pre-zeroed frames kept ready
+#define CONFIG_MEM_STATS    1                   // page allocator counters and latency histograms (TSC)
+#define MEM_MAX_RANGES      32                  // max number of free physical memory ranges at boot
+#define KMAP_SLOTS          64                  // number of temporary mappings of highmem frames
+#define ZONE_DMA_SIZE       0x01000000          // memory reachable by ISA DMA devices (16Mb)
+#define ZONE_DMA_RESERVE    256                 // DMA frames kept for ALLOC_DMA (not used as fallback)
+#define DMA_REGION_SIZE     0x00200000          // default size of the contiguous DMA region ("dma=" on the command line)
+#define DMA_REGION_ALIGN    16                  // DMA region alignment (in frames, 64Kb)
+
+
 // GDT defines
 #define GDT_NUMBERS  0x06               // number of entries in GDT
 #define KERNEL_CS   0x08                // Kernel code descriptor number
@@ -43,33 +59,115 @@
 #define ALIGN_PAGE(x) (((x)+(PAGE_SIZE)-1)&~((PAGE_SIZE)-1))
 
 #define PAGING_FLAG  0x80000000                   // CR0 - bit 31
+#define CR0_WP       0x00010000                   // CR0 - bit 16: read-only pages are enforced in kernel mode too
+#define PAGE_PRESENT  0x001                       // page entry flags
+#define PAGE_WRITE    0x002
+#define PAGE_USER     0x004
+#define PAGE_PWT      0x008
+#define PAGE_PCD      0x010
+#define PAGE_ACCESSED 0x020
+#define PAGE_DIRTY    0x040
+#define PAGE_LARGE    0x080
+#define PAGE_GLOBAL   0x100
+#define PAGE_COW      0x200                       // available bit: shared copy-on-write page (mapped read-only)
+#define PAGE_SWAP     0x400                       // available bit: not present entry of a page in the swap store
+#define PAGE_FLAGS    0xFFF
+#define PF_PROT      0x01                         // page fault error code: protection violation (else not present)
+#define PF_WRITE     0x02                         // page fault error code: write access
+#define PF_USER      0x04                         // page fault error code: user mode access
+#define PF_RSVD      0x08                         // page fault error code: reserved bit set
+#define CR4_PSE      0x00000010                   // CR4 - bit 4: 4Mb pages
+#define CR4_PAE      0x00000020                   // CR4 - bit 5: physical address extension
+#define CR4_PGE      0x00000080                   // CR4 - bit 7: global pages
+
+#if CONFIG_PAGING_PAE
+// PAE: the 4 page directories (one for each PDPT entry) are contiguous in memory
+// and indexed as a single 2048 entries directory
+#define PTRS_PER_PT   512
+#define PTRS_PER_PD   2048
+#define PTE_SIZE      8
+#define PGDIR_ORDER   2                           // the page directory is 4 pages
+#define LPAGE_SHIFT   21
+#define PTE_ADDR_MASK 0x000FFFFFFFFFF000ULL
+#define PDPT_ENTRIES  4
+#else
+#define PTRS_PER_PT   1024
+#define PTRS_PER_PD   1024
+#define PTE_SIZE      4
+#define PGDIR_ORDER   0
+#define LPAGE_SHIFT   22
+#define PTE_ADDR_MASK 0xFFFFF000
+#endif
+#define LPAGE_SIZE   (1 << LPAGE_SHIFT)           // 2Mb with PAE, else 4Mb
 #define PAGE(addr)   ((addr) >> 12)
-#define DIRE(addr)   ((addr) >> 22)
-#define GET_PD(addr) ((addr) & 0xFFC00000) >> 22  // Return Page Directory
-#define GET_PT(addr) ((addr) & 0x003FF000) >> 12  // Return Page Table
-
-// Enable paging
-# define EnablePaging()                   \
-    __asm__(                              \
-        /* PD_PHY_ADDR */                 \
-        "mov  %0, %%eax\n"                \
-        "mov  %%eax, %%cr3\n"             \
-        "mov  %%cr0, %%eax\n"             \
-        /* PAGING_FLAG */                 \
-        "or   $0x80000000, %%eax\n"       \
-        "mov  %%eax, %%cr0"               \
-        ::"m"(kpage_dir)                  \
-    );
+#define DIRE(addr)   ((addr) >> LPAGE_SHIFT)
+#define GET_PD(addr) ((addr) >> LPAGE_SHIFT)                        // Return Page Directory index
+#define GET_PT(addr) (((addr) >> PAGE_SHIFT) & (PTRS_PER_PT - 1))   // Return Page Table index
+
+// Kernel virtual memory layout
+//   0x00000000 - 0xBFFFFFFF  user space
+//   0xC0000000 - 0xF7FFFFFF  direct map of the physical memory (kernel image included)
+//   0xF8000000 - 0xFEFFFFFF  vmalloc area (virtually contiguous kernel buffers, ioremap)
+//   0xFF000000 - 0xFF7FFFFF  temporary mappings of highmem frames (kmap)
+//   PTE_BASE   - 0xFFFFFFFF  page tables self map (0xFFC00000, PAE: 0xFF800000)
+#define KERNEL_VIRT_BASE   0xC0000000                      // keep in sync with linker.ld
+#define LOWMEM_SIZE        0x38000000                      // max physical memory in the direct map (896Mb)
+#define VMALLOC_START      (KERNEL_VIRT_BASE + LOWMEM_SIZE) // first address of the vmalloc area
+#define VMALLOC_END        0xFF000000                      // end of the vmalloc area
+#define KMAP_BASE          0xFF000000                      // first kmap slot
+#if CONFIG_PAGING_PAE
+#define BOOT_MAP_SIZE      0x04000000                      // physical memory mapped by boot.S (64Mb)
+#else
+#define BOOT_MAP_SIZE      0x01000000                      // physical memory mapped by boot.S (16Mb)
+#endif
+
+// Page tables self map: the last page directory entries map the page directory
+// itself, so the entries of the current address space are at fixed addresses
+#define PTE_BASE           (0xFFFFFFFFu - PTRS_PER_PD * PAGE_SIZE + 1)             // all the page tables
+#define PDE_BASE           (PTE_BASE + (PTE_BASE >> PAGE_SHIFT) * PTE_SIZE)        // the page directory
+#define SELFMAP_PDE        (PTE_BASE >> LPAGE_SHIFT)                               // first self map entry
+#define PTE_VIRT(addr)     (&((pte_t *)PTE_BASE)[(uint32_t)(addr) >> PAGE_SHIFT])  // page table entry of addr
+#define PDE_VIRT(addr)     (&((pte_t *)PDE_BASE)[(uint32_t)(addr) >> LPAGE_SHIFT]) // page directory entry of addr
+
+#define PHYS_TO_VIRT(addr) ((void *)((uint32_t)(addr) + KERNEL_VIRT_BASE))
+#define VIRT_TO_PHYS(addr) ((uint32_t)(addr) - KERNEL_VIRT_BASE)
 
 
 // Frame defines
 #define FRAME(addr)   ((addr) >> 12)            // get frame number a given address is in
 #define BUDDY_MAX_ORDER 10                      // max order of buddy algorithm
-
-
-// Configuration defines
-#define KERNEL_RESERVED_MEM 0x00100000          // memory reserved for kernel
-
+#define FRAME_INDEX_BITS 24                     // frame index size in frame_t (up to 64Gb of memory)
+#define FRAME_NONE      ((1 << FRAME_INDEX_BITS) - 1)   // null frame index
+#if CONFIG_PAGING_PAE
+#define MAX_FRAMES      FRAME_NONE                      // 64Gb, but the frame metadata in the boot map limits it to about 28Gb
+#else
+#define MAX_FRAMES      (1 << (32 - PAGE_SHIFT))        // 4Gb
+#endif
+
+#define FRAME_INDEX(frame)    ((uint32_t)((frame) - kframelist))                // frame struct -> frame index
+#define FRAME_TO_PHYS(frame)  ((phys_addr_t)FRAME_INDEX(frame) << PAGE_SHIFT)   // frame struct -> physical address
+#define FRAME_IS_HIGH(frame)  (FRAME_INDEX(frame) >= nb_lowmem_frames)          // frame out of the direct map
+
+// Allocation flags: the zone to allocate from, lower zones are used as fallback
+#define ALLOC_NORMAL  0x00                      // direct mapped frames
+#define ALLOC_DMA     0x01                      // frames below ZONE_DMA_SIZE
+#define ALLOC_HIGHMEM 0x02                      // any frame, highmem first (use kmap to access it)
+#define ALLOC_NORECLAIM 0x04                    // fail instead of swapping out pages (optional allocations)
+#define PHYS_TO_FRAME(addr)   (&kframelist[FRAME(addr)])                        // physical address -> frame struct
+#define FRAME_TO_VIRT(frame)  PHYS_TO_VIRT(FRAME_TO_PHYS(frame))                // frame struct -> direct map address
+#define VIRT_TO_FRAME(addr)   PHYS_TO_FRAME(VIRT_TO_PHYS(addr))                 // direct map address -> frame struct
+
+
+#ifndef ASM
+
+// page table entry and physical address types
+#if CONFIG_PAGING_PAE
+typedef uint64_t pte_t;
+typedef uint64_t phys_addr_t;
+#else
+typedef uint32_t pte_t;
+typedef uint32_t phys_addr_t;
+#endif
 
 
 // Global Descriptor Table entry struct
@@ -96,7 +194,7 @@ struct gdtr
 gdtr_t;
 
 
-// page table/directory entry struct
+// page table/directory entry struct (32 bits paging)
 union addr_u
 {
   struct
@@ -145,26 +243,95 @@ typedef enum {
   FRAME_UNDEF,
   FRAME_AVAIL,
   FRAME_RESERV,
-  FRAME_KERNEL,
   FRAME_KUSED,
-  FRAME_USED
+  FRAME_USED,
+  FRAME_SLAB,
+  FRAME_DMA
 } frame_state_t;
 
   
-// frame page struct
+// frame page struct (8 bytes per frame)
+//   list links are frame indexes (FRAME_NONE ends a list), state and order
+//   are packed in the same words
+//   the frames of a slab (FRAME_SLAB) use next for the index of the first frame of the slab
+//   refcount: number of extra mappings of a page shared by address spaces (0: one owner)
 typedef struct frame {
-  frame_state_t state;
-  struct frame *next, *prev;
+  uint32_t next  : FRAME_INDEX_BITS;
+  uint32_t state : 4;                   // frame_state_t
+  uint32_t order : 4;                   // order of the block (first frame of a block only)
+  uint32_t prev  : FRAME_INDEX_BITS;
+  uint32_t refcount : 8;
 } frame_t;
 
+#define FRAME_REFCOUNT_MAX  255
+
 
 // free area struct (used by buddy algorithm)
+//   free_list: index of the first free block of this order (the block state is kept in its first frame)
+//   map: one bit for each pair of buddies, set when only one of the two is free
+//   nr_free: number of blocks in free_list
 typedef struct free_area_struct {
-  frame_t *free_list;
-  uint32_t map;
+  uint32_t free_list;
+  uint32_t nr_free;
+  uint32_t *map;
 } free_area_t;
 
 
+// memory zones: the frames for ISA DMA, the direct mapped frames
+// and the highmem frames (only reachable with kmap)
+typedef enum {
+  ZONE_DMA,
+  ZONE_NORMAL,
+  ZONE_HIGHMEM,
+  NR_ZONES
+} zone_type_t;
+
+
+// zone struct: a buddy allocator on the frames [start, end)
+//   start is aligned on the biggest block so blocks never cross a zone
+//   reserve: free frames not given to the allocations falling back from upper zones
+typedef struct zone {
+  uint32_t start;
+  uint32_t end;
+  uint32_t nr_free;
+  uint32_t reserve;
+  free_area_t free_area[BUDDY_MAX_ORDER];
+} zone_t;
+
+
+// pre-zeroed frame pool struct (stack of zeroed frames)
+typedef struct zero_pool {
+  uint32_t nfree;
+  frame_t *frames[ZERO_POOL_SIZE];
+} zero_pool_t;
+
+
+// page allocator statistics snapshot (mem__get_stats)
+//   free_blocks: free blocks of each order in each zone
+//   *_lat: log2 histograms of the cycles spent in mem__alloc_pages / mem__free_pages
+//   the counters and histograms stay at 0 without CONFIG_MEM_STATS
+#define MEM_LAT_BUCKETS 32
+
+typedef struct mem_stats {
+  uint32_t nr_free[NR_ZONES];
+  uint32_t free_blocks[NR_ZONES][BUDDY_MAX_ORDER];
+  uint32_t allocs[BUDDY_MAX_ORDER];
+  uint32_t frees[BUDDY_MAX_ORDER];
+  uint32_t failures[BUDDY_MAX_ORDER];
+  uint32_t splits;
+  uint32_t merges;
+  uint32_t alloc_lat[MEM_LAT_BUCKETS];
+  uint32_t free_lat[MEM_LAT_BUCKETS];
+} mem_stats_t;
+
+
+// physical memory range struct (frame indexes, end excluded)
+typedef struct mem_range {
+  uint32_t start;
+  uint32_t end;
+} mem_range_t;
+
+
 // phisical memory layout struct
 typedef
 struct memphy_layout
@@ -173,17 +340,50 @@ struct memphy_layout
     uint32_t memsize_nframes;
     uint32_t phyaddr_kernel_start;
     uint32_t phyaddr_kernel_end;
+    uint32_t phyaddr_arena_end;         // end of the boot arena (available memory after the kernel)
 } __attribute__((packed))
 memphy_layout_t;
 
 
 
+/* mem globals */
+extern frame_t *kframelist;
+extern pte_t *kpage_dir;
+extern uint32_t nb_lowmem_frames;
+extern mem_range_t dma_region;
+
+
+
 /* PUBLIC mem functions */
 void mem__bss_init(void);
 void mem__gdt_init(void);
 void mem__paging_init(uint32_t multiboot_info_addr);
 void mem__pagefaultirq(void);
 void mem__dump_map(void);
+frame_t *mem__alloc_pages(uint32_t order, uint32_t flags);
+void mem__free_pages(frame_t *frame, uint32_t order);
+bool mem__page_ref(frame_t *frame);
+void mem__page_unref(frame_t *frame);
+uint32_t mem__frame_zone(frame_t *frame);
+frame_t *mem__alloc_zeroed_page(uint32_t flags);
+frame_t *mem__alloc_zeroed_highpage(uint32_t flags);
+void mem__zero_pool_refill(void);
+void mem__clear_page(void *page);
+void *mem__kmap(frame_t *frame);
+void mem__kunmap(void *vaddr);
+pte_t *mem__get_pte(uint32_t vaddr, bool alloc);
+void mem__set_pte(pte_t *pte, pte_t val);
+bool mem__map_page(uint32_t vaddr, phys_addr_t paddr, uint32_t flags);
+pte_t mem__unmap_page(uint32_t vaddr);
+pte_t mem__unmap_page_lazy(uint32_t vaddr);
+void mem__tlb_flush_page(uint32_t vaddr);
+void mem__tlb_flush(void);
+void mem__tlb_flush_global(void);
+void mem__get_stats(mem_stats_t *stats);
+uint32_t mem__frag_index(uint32_t zone, uint32_t order);
+void mem__dump_stats(void);
+
+#endif /* ! ASM */
 
 
 #endif /* SIMOS_MEM_H */
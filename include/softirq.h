@@ -0,0 +1,52 @@
+/*
+ * Copyright (C) 2013 - Simone Rotondo - http://www.piemontewireless.net/
+ * simOS - tiny x86 kernel
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SIMOS_SOFTIRQ_H
+#define SIMOS_SOFTIRQ_H
+
+// standard includes
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+
+// softirq types (one pending bit each, lower numbers run first)
+typedef enum softirq_type {
+  SOFTIRQ_KBD = 0,
+  NR_SOFTIRQS
+} softirq_type_t;
+
+
+#define SOFTIRQ_MAX_RESTART 8               // rounds on interrupt return, the rest is left to the idle loop
+
+
+// softirq handler type (runs with interrupts enabled)
+typedef void (*softirq_func_t)(void);
+
+
+
+/* PUBLIC softirq functions */
+void softirq__init(void);
+void softirq__register(softirq_type_t nr, softirq_func_t handler);
+void softirq__raise(softirq_type_t nr);
+void softirq__irq_exit(uint32_t *regs);
+void softirq__run(void);
+
+
+#endif /* SIMOS_SOFTIRQ_H */
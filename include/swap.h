@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2013 - Simone Rotondo - http://www.piemontewireless.net/
+ * simOS - tiny x86 kernel
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SIMOS_SWAP_H
+#define SIMOS_SWAP_H
+
+// standard includes
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+
+// compressed swap store sizes
+#define SWAP_MAX_SLOTS      16384           // max number of swapped out pages
+#define SWAP_POOL_PAGES     4096            // max number of pages of the store
+#define SWAP_POOL_SPARE     4               // store pages allocated at init (reclaim needs room)
+#define SWAP_UNIT_SHIFT     5               // store allocation unit: 32 bytes
+#define SWAP_MAX_BLOB       3072            // pages compressed to more bytes stay in memory
+#define SWAP_RECLAIM_BATCH  32              // min number of pages reclaimed at a time
+
+
+// swap entries are kept in the not present page table entries (PAGE_SWAP set)
+#define SWAP_NONE           0
+#define SWAP_TO_PTE(entry)  (((pte_t)(entry) << PAGE_SHIFT) | PAGE_SWAP)
+#define PTE_TO_SWAP(pte)    ((uint32_t)((pte) >> PAGE_SHIFT))
+
+
+
+/* PUBLIC swap functions */
+void swap__init(void);
+uint32_t swap__store(const void *page);
+bool swap__load(uint32_t entry, void *page);
+void swap__dup(uint32_t entry);
+void swap__free(uint32_t entry);
+void swap__dump(void);
+
+
+#endif /* SIMOS_SWAP_H */
@@ -30,13 +30,42 @@
 #define hlt() __asm__("hlt");
 
 
+// CPUID leaf 1 EDX feature bits
+#define CPUID_FEAT_EDX_PSE      (1 << 3)        // Page Size Extension
+#define CPUID_FEAT_EDX_TSC      (1 << 4)        // Time Stamp Counter
+#define CPUID_FEAT_EDX_PAE      (1 << 6)        // Physical Address Extension
+#define CPUID_FEAT_EDX_APIC     (1 << 9)        // On-chip APIC
+#define CPUID_FEAT_EDX_PGE      (1 << 13)       // Page Global Enable
+#define CPUID_FEAT_EDX_SSE2     (1 << 26)       // SSE2 extensions
+
+
 
 /* PUBLIC utils functions */
 void memset(void *buf, uint8_t val, size_t len);
 void memcpy(void *dst, const void *src, size_t len);
+void memmove(void *dst, const void *src, size_t len);
 size_t strlen(const char* str);
+int strncmp(const char *s1, const char *s2, size_t n);
+uint32_t memparse(const char *str, const char **end);
+bool bitmap_test(const uint32_t *map, uint32_t bit);
+void bitmap_set(uint32_t *map, uint32_t start, uint32_t n);
+void bitmap_clear(uint32_t *map, uint32_t start, uint32_t n);
+uint32_t bitmap_find_free(const uint32_t *map, uint32_t from, uint32_t to, uint32_t n);
 uint8_t inb(uint16_t port);
 void outb(uint8_t value, uint16_t port);
+void cpuid(uint32_t leaf, uint32_t *eax, uint32_t *ebx, uint32_t *ecx, uint32_t *edx);
+bool cpu_has_feature(uint32_t edx_feature);
+uint32_t read_cr0(void);
+void write_cr0(uint32_t value);
+uint32_t read_cr3(void);
+void write_cr3(uint32_t value);
+uint32_t read_cr4(void);
+void write_cr4(uint32_t value);
+uint64_t rdtsc(void);
+void rdmsr(uint32_t msr, uint32_t *lo, uint32_t *hi);
+void wrmsr(uint32_t msr, uint32_t lo, uint32_t hi);
+uint32_t ilog2(uint32_t value);
+uint64_t div64(uint64_t n, uint32_t d);
 
 
 #endif /* SIMOS_UTILS_H */
@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2013 - Simone Rotondo - http://www.piemontewireless.net/
+ * simOS - tiny x86 kernel
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SIMOS_VMALLOC_H
+#define SIMOS_VMALLOC_H
+
+// standard includes
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// simOS includes
+#include "mem.h"
+
+
+
+// vmalloc defines
+#define VMALLOC_PAGES       ((VMALLOC_END - VMALLOC_START) >> PAGE_SHIFT)
+#define VMALLOC_LAZY_MAX    1024            // unmapped pages waiting for a TLB purge (4Mb)
+
+
+
+/* PUBLIC vmalloc functions */
+void vmalloc__init(void);
+void vmalloc__purge(void);
+void vmalloc__dump(void);
+void *vmap(frame_t **frames, uint32_t npages, uint32_t flags);
+void vunmap(void *addr);
+void *vmalloc(size_t size);
+void vfree(void *addr);
+void *ioremap(phys_addr_t paddr, size_t size);
+void iounmap(void *addr);
+
+
+#endif /* SIMOS_VMALLOC_H */
@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2013 - Simone Rotondo - http://www.piemontewireless.net/
+ * simOS - tiny x86 kernel
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SIMOS_VMM_H
+#define SIMOS_VMM_H
+
+// standard includes
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+
+// virtual memory area flags
+#define VMA_READ        0x01            // pages can be read
+#define VMA_WRITE       0x02            // pages can be written
+#define VMA_USER        0x04            // pages can be accessed from user mode
+#define VMA_ANON        0x08            // anonymous memory: zero filled on the first access
+#define VMA_FAULTAROUND 0x10            // map the following pages too on a fault
+
+
+// fault-around window (in pages)
+#define VMA_FAULT_WINDOW        16      // initial window
+#define VMA_FAULT_WINDOW_MIN    1       // window after random faults
+#define VMA_FAULT_WINDOW_MAX    256     // window after sequential faults
+
+
+
+// virtual memory area struct, [start, end) is page aligned
+typedef struct vma {
+  uint32_t start;
+  uint32_t end;
+  uint32_t flags;
+  uint32_t fault_window;                // pages mapped by the next fault (VMA_FAULTAROUND)
+  uint32_t fault_next;                  // address of the next fault of a sequential scan
+  struct vma *next, *prev;
+} vma_t;
+
+
+
+// address space struct
+//   the kernel part of the page directory is the same in all the address spaces
+typedef struct mm {
+  pte_t *pgdir;                         // page directory (direct map address)
+  void *pdpt;                           // page directory pointer table (PAE only)
+  uint32_t cr3;
+  vma_t *vmas;                          // virtual memory areas, sorted by address
+  vma_t *vma_last;                      // last area found by vmm__find_area()
+  struct mm *next, *prev;
+} mm_t;
+
+
+
+/* vmm globals */
+extern mm_t *current_mm;
+
+
+
+/* PUBLIC vmm functions */
+void vmm__init(void);
+vma_t *vmm__area_create(uint32_t start, uint32_t len, uint32_t flags);
+void vmm__area_destroy(vma_t *vma);
+void vmm__area_set_window(vma_t *vma, uint32_t npages);
+vma_t *vmm__find_area(uint32_t addr);
+bool vmm__handle_fault(uint32_t addr, uint32_t error_code);
+void vmm__dump_areas(void);
+mm_t *vmm__mm_clone(void);
+void vmm__mm_switch(mm_t *mm);
+void vmm__mm_destroy(mm_t *mm);
+uint32_t vmm__reclaim(uint32_t npages, uint32_t zone);
+
+
+#endif /* SIMOS_VMM_H */
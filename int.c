@@ -28,6 +28,7 @@
 #include "console.h"
 #include "multiboot.h"
 #include "mem.h"
+#include "vmalloc.h"
 #include "int_vectors.h"
 #include "int.h"
 
@@ -39,6 +40,23 @@ idt_t  g_kidt[IDT_ENTRIES+1];           // Interrupt Descriptor Table
 idtr_t g_kidtr;                         // Interrupt Descriptor Table Register
 
 irqvfunc_t g_irqvector[NR_IRQS];        // IRQ vector function table
+#if CONFIG_IRQ_STATS
+irq_stats_t g_irqstats[NR_IRQS];        // IRQ statistics
+uint64_t irq_entry_tsc;                 // Timestamp of the last entry stub (int_vectors.S)
+#endif
+
+irq_chip_t *irq_chip;                   // Interrupt controller in use
+volatile uint32_t *lapic;               // Local APIC registers
+volatile uint32_t *ioapic;              // I/O APIC registers
+uint32_t ioapic_pins;                   // Number of I/O APIC inputs
+uint32_t ioapic_redtbl[NR_HW_IRQS];     // Redirection entries (low words) of the irqs
+uint8_t  pic_masks[2];                  // 8259 masks (master, slave) as written to the PICs
+uint8_t  prio_vector_irq[NR_PRIO_VECTORS];  // irq of each priority vector (stale until reused)
+
+// one bit per irq (IRQ0 is bit 0): the hardware is only touched when irq_masked changes
+uint32_t irq_masked;                    // masked in the interrupt controller
+uint32_t irq_disabled;                  // disabled by int__disable_irq() (masked on the next hit)
+uint32_t irq_pending;                   // hit while disabled, replayed by int__enable_irq()
 
 
 
@@ -56,6 +74,11 @@ void irq_unhandled_isr(uint8_t irq, uint32_t *context)
 uint32_t *irq_dispatch(uint8_t irq, uint32_t *regs)
 {
     irqvfunc_t vector;
+#if CONFIG_IRQ_STATS
+    irq_stats_t *stats;
+    uint64_t start;
+    uint32_t cycles, latency;
+#endif
 
     if ((irq >= NR_IRQS) || (g_irqvector[irq] == NULL)) {
         vector = irq_unhandled_isr;
@@ -64,9 +87,37 @@ uint32_t *irq_dispatch(uint8_t irq, uint32_t *regs)
         vector = g_irqvector[irq];
     }
 
+#if CONFIG_IRQ_STATS
+    // the latency is taken before the handler: a nested exception (#PF)
+    // overwrites irq_entry_tsc, a replayed irq (no context) has no entry stub
+    start = rdtsc();
+    latency = (regs != NULL) ? (uint32_t)(start - irq_entry_tsc) : 0;
+#endif
+
     // Dispatch to the interrupt handler
     vector(irq, regs);
 
+#if CONFIG_IRQ_STATS
+    // interrupts are still disabled: nothing else updates the stats
+    if (irq >= NR_IRQS)
+        return regs;
+
+    cycles = (uint32_t)(rdtsc() - start);
+    stats = &g_irqstats[irq];
+    stats->count++;
+    stats->cycles += cycles;
+    if (cycles > stats->max_cycles)
+        stats->max_cycles = cycles;
+    stats->hist[ilog2(cycles)]++;
+
+    if (regs != NULL) {
+        stats->latency += latency;
+        stats->latency_count++;
+        if (latency > stats->max_latency)
+            stats->max_latency = latency;
+    }
+#endif
+
     return regs; 
 }
 
@@ -89,17 +140,30 @@ uint32_t *irq_handler(uint32_t *regs)
     uint32_t *ret;
     uint8_t irq;
 
-    // Get the IRQ number
+    // Get the IRQ number, a priority vector gives it back (the handlers see the irq)
     irq = (uint8_t)regs[REG_IRQNO];
+    if (irq >= IRQ_PRIO_VECTOR_FIRST) {
+        irq = prio_vector_irq[irq - IRQ_PRIO_VECTOR_FIRST];
+        if (irq == 0) {
+            irq_chip->eoi(irq);
+            return regs;
+        }
+        regs[REG_IRQNO] = irq;
+    }
 
-    // Send an EOI (end of interrupt) signal to the PICs
-    if (irq >= IRQ8) {
-        // Send reset signal to slave
-        outb(PIC_EOI, PIC_SLAVE_CMD);
+    // lazy disable: the irq is masked for real now that it fired, it is replayed on enable
+    if (irq_disabled & IRQ_BIT(irq)) {
+        irq_pending |= IRQ_BIT(irq);
+        if (!(irq_masked & IRQ_BIT(irq))) {
+            irq_masked |= IRQ_BIT(irq);
+            irq_chip->mask(irq);
+        }
+        irq_chip->eoi(irq);
+        return regs;
     }
 
-    // Send reset signal to master
-    outb(PIC_EOI, PIC_MASTER_CMD);
+    // Send an EOI (end of interrupt) signal to the interrupt controller
+    irq_chip->eoi(irq);
 
     // Dispatch the interrupt
     ret = irq_dispatch(irq, regs);
@@ -163,6 +227,8 @@ static void __remap_pic(void)
     // Mask all interrupts (in this way ints remains masked and disabled)
     outb(PIC_MASTER_MASK, PIC_MASTER_DATA);
     outb(PIC_SLAVE_MASK, PIC_SLAVE_DATA);
+    pic_masks[0] = PIC_MASTER_MASK;
+    pic_masks[1] = PIC_SLAVE_MASK;
 }
 
 
@@ -176,46 +242,261 @@ static void __init_irqvectors(void)
 }
 
 
-// Return the interrupt mask
+// Return the interrupt mask (cached, no port read)
 // arg: pic PIC_MASTER or PIC_SLAVE
 // ret: uint8_t Mask or 0 on error
 static uint8_t __get_picmask(uint8_t pic)
 {
-    uint8_t mask;
-    if ((pic != PIC_MASTER_DATA) && (pic != PIC_SLAVE_DATA)) {
+    if (pic == PIC_MASTER_DATA)
+        return pic_masks[0];
+    else if (pic == PIC_SLAVE_DATA)
+        return pic_masks[1];
+    else
         return(0);
-    } 
-    else {
-        mask = inb(pic);
-        return(mask);
-    }
 }
 
 
-// Set the interrupt mask
+// Set the interrupt mask (the port is written only when the mask changes)
 // arg1: uint8_t Mask
 // arg2: pic PIC_MASTER or PIC_SLAVE
 static void __set_picmask(uint8_t mask, uint8_t pic)
 {
-    if ((pic == PIC_MASTER_DATA) || (pic == PIC_SLAVE_DATA)) {
+    uint8_t *cache;
+
+    if (pic == PIC_MASTER_DATA)
+        cache = &pic_masks[0];
+    else if (pic == PIC_SLAVE_DATA)
+        cache = &pic_masks[1];
+    else
+        return;
+
+    if (*cache != mask) {
+        *cache = mask;
         outb(mask, pic);
     }
 }
 
 
 
+// 8259 PIC operations
+
+static void __pic_eoi(uint8_t irq)
+{
+    if (irq >= IRQ8) {
+        // Send reset signal to slave
+        outb(PIC_EOI, PIC_SLAVE_CMD);
+    }
+
+    // Send reset signal to master
+    outb(PIC_EOI, PIC_MASTER_CMD);
+}
+
+
+static void __pic_mask(uint8_t irq)
+{
+    uint8_t pic;
+    uint8_t regbit;
+
+    // the cascade line stays open for the slave
+    if (irq == IRQ2)
+        return;
+
+    if (irq <= IRQ7) {
+        pic = PIC_MASTER_DATA;
+        regbit  = (1 << (irq - IRQ0));
+    }
+    else if (irq <= IRQ15) {
+        pic = PIC_SLAVE_DATA;
+        regbit  = (1 << (irq - IRQ8));
+    }
+    else {
+        return;
+    }
+
+    __set_picmask(__get_picmask(pic) | regbit, pic);
+}
+
+
+static void __pic_unmask(uint8_t irq)
+{
+    uint8_t pic;
+    uint8_t regbit;
+
+    if (irq <= IRQ7) {
+        pic = PIC_MASTER_DATA;
+        regbit  = (1 << (irq - IRQ0));
+    }
+    else if (irq <= IRQ15) {
+        pic = PIC_SLAVE_DATA;
+        regbit  = (1 << (irq - IRQ8));
+    }
+    else {
+        return;
+    }
+
+    __set_picmask(__get_picmask(pic) & ~regbit, pic);
+}
+
+
+irq_chip_t pic_chip = {
+    .name   = "8259 PIC",
+    .init   = __remap_pic,
+    .eoi    = __pic_eoi,
+    .mask   = __pic_mask,
+    .unmask = __pic_unmask,
+};
+
+
+// Local APIC and I/O APIC operations
+
+static inline uint32_t __lapic_read(uint32_t reg)
+{
+    return lapic[reg / 4];
+}
+
+
+static inline void __lapic_write(uint32_t reg, uint32_t value)
+{
+    lapic[reg / 4] = value;
+}
+
+
+static inline uint32_t __ioapic_read(uint32_t reg)
+{
+    ioapic[IOAPIC_REGSEL / 4] = reg;
+    return ioapic[IOAPIC_WIN / 4];
+}
+
+
+static inline void __ioapic_write(uint32_t reg, uint32_t value)
+{
+    ioapic[IOAPIC_REGSEL / 4] = reg;
+    ioapic[IOAPIC_WIN / 4] = value;
+}
+
+
+// I/O APIC input of an irq (-1 if none): the ISA irqs keep their numbers
+// but the PIT, wired to input 2 (the usual interrupt source override),
+// and IRQ2 (the 8259 cascade) does not exist
+static inline int32_t __ioapic_pin(uint8_t irq)
+{
+    int32_t pin;
+
+    if (irq == IRQ0)
+        pin = 2;
+    else if (irq == IRQ2)
+        pin = -1;
+    else
+        pin = irq - IRQ0;
+
+    return (pin < (int32_t)ioapic_pins) ? pin : -1;
+}
+
+
+static void __apic_init(void)
+{
+    uint32_t lo, hi, id, pin, low;
+    uint8_t irq;
+
+    // the 8259s are remapped then masked: their spurious irqs can't hit the exceptions
+    __remap_pic();
+    __set_picmask(0xFF, PIC_MASTER_DATA);
+    __set_picmask(0xFF, PIC_SLAVE_DATA);
+
+    rdmsr(MSR_APIC_BASE, &lo, &hi);
+    wrmsr(MSR_APIC_BASE, lo | MSR_APIC_BASE_ENABLE, hi);
+
+    lapic = ioremap(lo & PAGE_MASK, PAGE_SIZE);
+    ioapic = ioremap(IOAPIC_BASE, PAGE_SIZE);
+    KASSERT((lapic != NULL) && (ioapic != NULL));
+
+    // accept all the priorities, software enable with the spurious vector
+    __lapic_write(LAPIC_TPR, 0);
+    __lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | IRQ_SPURIOUS);
+    id = __lapic_read(LAPIC_ID) >> 24;
+
+    ioapic_pins = ((__ioapic_read(IOAPIC_VER) >> 16) & 0xFF) + 1;
+    for (pin=0; pin<ioapic_pins; pin++)
+        __ioapic_write(IOAPIC_REDTBL(pin), IOAPIC_MASKED);
+
+    // all the irqs are sent to this cpu, masked: ISA ones are edge
+    // triggered active high, PCI ones (IRQ16..) level triggered active low
+    for (irq=IRQ0; irq<IRQ0+NR_HW_IRQS; irq++) {
+        if (__ioapic_pin(irq) < 0)
+            continue;
+
+        pin = __ioapic_pin(irq);
+        low = IOAPIC_MASKED | irq;
+        if (irq >= IRQ16)
+            low |= IOAPIC_LEVEL | IOAPIC_ACTIVE_LOW;
+
+        __ioapic_write(IOAPIC_REDTBL(pin) + 1, id << 24);
+        __ioapic_write(IOAPIC_REDTBL(pin), low);
+        ioapic_redtbl[irq - IRQ0] = low;
+    }
+}
+
+
+// memory mapped EOI: no port I/O
+static void __apic_eoi(uint8_t irq)
+{
+    __lapic_write(LAPIC_EOI, 0);
+}
+
+
+static void __apic_mask(uint8_t irq)
+{
+    int32_t pin = __ioapic_pin(irq);
+
+    if (pin >= 0) {
+        ioapic_redtbl[irq - IRQ0] |= IOAPIC_MASKED;
+        __ioapic_write(IOAPIC_REDTBL(pin), ioapic_redtbl[irq - IRQ0]);
+    }
+}
+
+
+static void __apic_unmask(uint8_t irq)
+{
+    int32_t pin = __ioapic_pin(irq);
+
+    if (pin >= 0) {
+        ioapic_redtbl[irq - IRQ0] &= ~IOAPIC_MASKED;
+        __ioapic_write(IOAPIC_REDTBL(pin), ioapic_redtbl[irq - IRQ0]);
+    }
+}
+
+
+irq_chip_t apic_chip = {
+    .name   = "APIC",
+    .init   = __apic_init,
+    .eoi    = __apic_eoi,
+    .mask   = __apic_mask,
+    .unmask = __apic_unmask,
+};
+
+
+
 /* ====== PUBLIC int functions ====== */
 
 // Init interrupts
 void int__idt_init(void)
 {
-    memset(&g_kidt, 0, sizeof(idt_t)*IDT_ENTRIES);
+    uint32_t i;
+
+    memset(&g_kidt, 0, sizeof(g_kidt));
 
     // init irq vectors
     __init_irqvectors();
 
-    // remap PICs
-    __remap_pic();
+    // init the interrupt controller, all the irqs masked
+    irq_masked = irq_disabled = (1 << NR_HW_IRQS) - 1;
+    irq_pending = 0;
+    irq_chip = &pic_chip;
+#if CONFIG_X86_APIC
+    if (cpu_has_feature(CPUID_FEAT_EDX_APIC))
+        irq_chip = &apic_chip;
+#endif
+    irq_chip->init();
 
     __set_idt(ISR0, (uint32_t)vector_isr0, KERNEL_CS, DEF_INTGATE_FLAGS);
     __set_idt(ISR1, (uint32_t)vector_isr1, KERNEL_CS, DEF_INTGATE_FLAGS);
@@ -266,8 +547,22 @@ void int__idt_init(void)
     __set_idt(IRQ13, (uint32_t)vector_irq13, KERNEL_CS, DEF_INTGATE_FLAGS);
     __set_idt(IRQ14, (uint32_t)vector_irq14, KERNEL_CS, DEF_INTGATE_FLAGS);
     __set_idt(IRQ15, (uint32_t)vector_irq15, KERNEL_CS, DEF_INTGATE_FLAGS);
-
-    g_kidtr.limit = sizeof(idt_t) * IDT_ENTRIES;
+    __set_idt(IRQ16, (uint32_t)vector_irq16, KERNEL_CS, DEF_INTGATE_FLAGS);
+    __set_idt(IRQ17, (uint32_t)vector_irq17, KERNEL_CS, DEF_INTGATE_FLAGS);
+    __set_idt(IRQ18, (uint32_t)vector_irq18, KERNEL_CS, DEF_INTGATE_FLAGS);
+    __set_idt(IRQ19, (uint32_t)vector_irq19, KERNEL_CS, DEF_INTGATE_FLAGS);
+    __set_idt(IRQ20, (uint32_t)vector_irq20, KERNEL_CS, DEF_INTGATE_FLAGS);
+    __set_idt(IRQ21, (uint32_t)vector_irq21, KERNEL_CS, DEF_INTGATE_FLAGS);
+    __set_idt(IRQ22, (uint32_t)vector_irq22, KERNEL_CS, DEF_INTGATE_FLAGS);
+    __set_idt(IRQ23, (uint32_t)vector_irq23, KERNEL_CS, DEF_INTGATE_FLAGS);
+    __set_idt(IRQ_SPURIOUS, (uint32_t)vector_spurious, KERNEL_CS, DEF_INTGATE_FLAGS);
+
+    // priority vectors (APIC), the stubs have the same size
+    for (i=0; i<NR_PRIO_VECTORS; i++)
+        __set_idt(IRQ_PRIO_VECTOR_FIRST + i, (uint32_t)vector_prio + i * IRQ_PRIO_STUB_SIZE, KERNEL_CS, DEF_INTGATE_FLAGS);
+
+    // the limit is the offset of the last byte
+    g_kidtr.limit = sizeof(idt_t) * (IDT_ENTRIES + 1) - 1;
     g_kidtr.base  = (uint32_t)&g_kidt;
 
     __load_idt();
@@ -298,61 +593,145 @@ void int__irq_attach(uint8_t irq, irqvfunc_t isr)
 }
 
 
-// Enable (unmask) the specified interrupt
+// Enable (unmask) the specified interrupt, an edge triggered irq that hit while
+// it was disabled is handled now (its handler gets a NULL context)
 void int__enable_irq(uint8_t irq)
 {
-    uint8_t pic;
-    uint8_t regbit;
-    uint8_t mask;
+    uint32_t state;
 
-    if (irq >= IRQ0) {
+    if ((irq < IRQ0) || (irq >= IRQ0 + NR_HW_IRQS))
+        return;
 
-        if (irq <= IRQ7) {
-            pic = PIC_MASTER_DATA;
-            regbit  = (1 << (irq - IRQ0));
-        }
-        else if (irq <= IRQ15) {
-            pic = PIC_SLAVE_DATA;
-            regbit  = (1 << (irq - IRQ8));
-        }
-        else {
-            return;
-        }
+    state = int__irqsave();
+
+    irq_disabled &= ~IRQ_BIT(irq);
+    if (irq_masked & IRQ_BIT(irq)) {
+        irq_masked &= ~IRQ_BIT(irq);
+        irq_chip->unmask(irq);
+    }
 
-        // Enable (unmask) the interrupt
-        mask = __get_picmask(pic);
-        mask &= ~regbit;
-        __set_picmask(mask, pic);
+    // replay the edge of a pending irq, a level one fires again by itself
+    // once unmasked if the line is still asserted
+    if (irq_pending & IRQ_BIT(irq)) {
+        irq_pending &= ~IRQ_BIT(irq);
+        if (!(ioapic_redtbl[irq - IRQ0] & IOAPIC_LEVEL))
+            irq_dispatch(irq, NULL);
     }
+
+    int__irqrestore(state);
 }
 
 
-// Disable (mask) the specified interrupt
+// Disable the specified interrupt: lazy, the irq is only masked in the
+// interrupt controller if it fires while disabled
 void int__disable_irq(uint8_t irq)
 {
-    uint8_t pic;
-    uint8_t regbit;
-    uint8_t mask;
+    uint32_t state;
 
-    if (irq >= IRQ0) {
+    if ((irq < IRQ0) || (irq >= IRQ0 + NR_HW_IRQS))
+        return;
 
-        if (irq <= IRQ7) {
-            pic = PIC_MASTER_DATA;
-            regbit  = (1 << (irq - IRQ0));
-        }
-        else if (irq <= IRQ15) {
-            pic = PIC_SLAVE_DATA;
-            regbit  = (1 << (irq - IRQ8));
+    state = int__irqsave();
+    irq_disabled |= IRQ_BIT(irq);
+    int__irqrestore(state);
+}
+
+
+const char *int__chip_name(void)
+{
+    return irq_chip->name;
+}
+
+
+// Set the task priority (APIC only): the irqs of priority class
+// (vector >> 4) lower or equal to class are held back.
+// The classes are fixed by the irq numbers (2: IRQ0-15, 3: IRQ16-23), a line
+// can't be given a higher priority than another one of the same class.
+void int__set_priority(uint8_t class)
+{
+    if (irq_chip == &apic_chip)
+        __lapic_write(LAPIC_TPR, (class & 0x0F) << 4);
+}
+
+
+uint8_t int__get_priority(void)
+{
+    if (irq_chip == &apic_chip)
+        return (__lapic_read(LAPIC_TPR) >> 4) & 0x0F;
+    return 0;
+}
+
+
+// Give an irq its own priority (APIC only): a class from IRQ_PRIO_VECTOR_FIRST >> 4
+// to (IRQ_PRIO_VECTOR_END >> 4) - 1 moves it to a free vector of that class, above
+// the default ones; its default class (IRQ0-15: 2, IRQ16-23: 3) gives its vector back
+// ret: false with the PIC, without an I/O APIC pin or if the class is full
+bool int__irq_set_priority(uint8_t irq, uint8_t class)
+{
+    uint32_t state;
+    uint32_t vector, v, owner;
+
+    if ((irq_chip != &apic_chip) || (irq < IRQ0) || (irq >= IRQ0 + NR_HW_IRQS) || (__ioapic_pin(irq) < 0))
+        return false;
+
+    if ((class != (irq >> 4)) &&
+        ((class < (IRQ_PRIO_VECTOR_FIRST >> 4)) || (class >= (IRQ_PRIO_VECTOR_END >> 4))))
+        return false;
+
+    state = int__irqsave();
+
+    vector = irq;
+    if (class != (irq >> 4)) {
+        // a vector is free when its irq has moved elsewhere (in flight hits still find the irq)
+        for (vector=0, v=class << 4; v<(uint32_t)(class + 1) << 4; v++) {
+            owner = prio_vector_irq[v - IRQ_PRIO_VECTOR_FIRST];
+            if ((owner == irq) || (owner == 0) || ((ioapic_redtbl[owner - IRQ0] & 0xFF) != v)) {
+                vector = v;
+                break;
+            }
         }
-        else {
-            return;
+        if (vector == 0) {
+            int__irqrestore(state);
+            return false;
         }
+        prio_vector_irq[vector - IRQ_PRIO_VECTOR_FIRST] = irq;
+    }
+
+    ioapic_redtbl[irq - IRQ0] = (ioapic_redtbl[irq - IRQ0] & ~0xFF) | vector;
+    __ioapic_write(IOAPIC_REDTBL(__ioapic_pin(irq)), ioapic_redtbl[irq - IRQ0]);
+
+    int__irqrestore(state);
+    return true;
+}
+
 
-        // Disable (mask) the interrupt
-        mask = __get_picmask(pic);
-        mask |= regbit;
-        __set_picmask(mask, pic);
+void int__dump_stats(void)
+{
+#if CONFIG_IRQ_STATS
+    irq_stats_t stats;
+    uint32_t state;
+    uint32_t i, b;
+
+    console__printf("Vector count avg max latency(avg max) cycles\n");
+    for (i=0; i<NR_IRQS; i++) {
+        state = int__irqsave();
+        stats = g_irqstats[i];
+        int__irqrestore(state);
+
+        if (stats.count == 0)
+            continue;
+
+        // replayed irqs have no latency sample
+        console__printf("%d: %d %d %d (%d %d)\n", i, stats.count,
+                        (uint32_t)div64(stats.cycles, stats.count), stats.max_cycles,
+                        (stats.latency_count != 0) ? (uint32_t)div64(stats.latency, stats.latency_count) : 0,
+                        stats.max_latency);
+        for (b=0; b<IRQ_HIST_BUCKETS; b++) {
+            if (stats.hist[b] != 0)
+                console__printf("  < 2^%d: %d\n", b+1, stats.hist[b]);
+        }
     }
+#endif
 }
 
 
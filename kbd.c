@@ -26,6 +26,8 @@
 #include "kassert.h"
 #include "int_vectors.h"
 #include "int.h"
+#include "softirq.h"
+#include "console.h"
 #include "kbd.h"
 
 
@@ -73,17 +75,43 @@ uint8_t kbd_us[128] =
     0,                                                  /* All other keys are undefined */
 };  
 
+// scancodes from the top half to the bottom half (single producer, single consumer)
+uint8_t kbd_ring[KBD_RING_SIZE];
+volatile uint32_t kbd_head;             // written by the top half only
+volatile uint32_t kbd_tail;             // written by the bottom half only
+
 
 
 /* ====== IRQ handler functions ====== */
 
-// keyboard interrupt handler
+// keyboard interrupt handler (top half): read the scancode, the rest is deferred
 void isr_kbd(uint8_t irq, uint32_t *regs)
 {
     uint8_t ch = inb(0x60);
-    if ( !(ch & 0x80) )
-        console__printf("Key: %c\n", kbd_us[ch]);
-    
+
+    // the scancode is dropped when the ring is full
+    if (kbd_head - kbd_tail < KBD_RING_SIZE) {
+        kbd_ring[kbd_head % KBD_RING_SIZE] = ch;
+        kbd_head++;
+    }
+
+    softirq__raise(SOFTIRQ_KBD);
+}
+
+
+// keyboard bottom half: decode the scancodes
+void softirq_kbd(void)
+{
+    uint8_t ch;
+
+    while (kbd_tail != kbd_head) {
+        ch = kbd_ring[kbd_tail % KBD_RING_SIZE];
+        kbd_tail++;
+
+        if ( !(ch & 0x80) )
+            console__printf("Key: %c\n", kbd_us[ch]);
+    }
+
 //    <TODO/>  
 }
 
@@ -111,6 +139,8 @@ void kbd__init(void)
     __enablekbd();
 
     // Attach IRQ1 to the kbd interrupt handler
+    kbd_head = kbd_tail = 0;
+    softirq__register(SOFTIRQ_KBD, softirq_kbd);
     int__irq_attach(IRQ1, (irqvfunc_t)isr_kbd);
 
     // Clear the output buffer
@@ -32,8 +32,14 @@
 #include "utils.h"
 #include "multiboot.h"
 #include "mem.h"
+#include "kmem.h"
+#include "vmm.h"
+#include "vmalloc.h"
+#include "dma.h"
+#include "swap.h"
 #include "int_vectors.h"
 #include "int.h"
+#include "softirq.h"
 #include "timer.h"
 #include "kbd.h"
 
@@ -87,13 +93,37 @@ void kernel_main(uint32_t magic, uint32_t multiboot_info_addr)
     mem__paging_init(multiboot_info_addr);
     console__printf("* Memory Paging Enabled\n");
 
+    // Init kernel heap
+    kmem__init();
+    console__printf("* Init Kernel Heap\n");
+
+    // Init virtual memory areas
+    vmm__init();
+    console__printf("* Init Virtual Memory Areas\n");
+
+    // Init vmalloc area
+    vmalloc__init();
+    console__printf("* Init vmalloc Area\n");
+
+    // Init contiguous DMA buffers
+    dma__init();
+    console__printf("* Init DMA Buffers\n");
+
+    // Init compressed swap store
+    swap__init();
+    console__printf("* Init Compressed Swap\n");
+
     // Init IDT
     int__idt_init();
-    console__printf("* Init Interrupts\n");
+    console__printf("* Init Interrupts (%s)\n", int__chip_name());
 
     // attach page fault irq handler
     mem__pagefaultirq();
 
+    // Init bottom halves
+    softirq__init();
+    console__printf("* Init Softirqs\n");
+
     // Init TIMER
     timer__init();
     console__printf("* Init Timer\n");
@@ -110,11 +140,18 @@ void kernel_main(uint32_t magic, uint32_t multiboot_info_addr)
     // test interrupts 
     __asm__ ("int $34");
 */
+/*
     // test interrupts
 //    void (*x)(void) = 0x00000000;             // ISR6: invalid opcode
     void (*x)(void) = (void *)0xFFFF0000;       // ISR14: page fault
     x();
+*/
 
-    // Infinite loop
-    while(1);
+    // Idle loop: finish the deferred interrupt work, prepare zeroed pages,
+    // then wait for the next interrupt
+    while(1) {
+        softirq__run();
+        mem__zero_pool_refill();
+        hlt();
+    }
 }
@@ -0,0 +1,333 @@
+/*
+ * Copyright (C) 2013 - Simone Rotondo - http://www.piemontewireless.net/
+ * simOS - tiny x86 kernel
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// standard includes
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// simOS includes
+#include "utils.h"
+#include "kassert.h"
+#include "console.h"
+#include "mem.h"
+#include "int.h"
+#include "kmem.h"
+#include "utlist.h"
+
+
+
+/* ====== Globals ====== */
+
+kmem_cache_t  kmem_cache_cache;                         // cache of the kmem_cache_t structs
+kmem_cache_t *kmem_caches;                              // list of all caches
+kmem_cache_t *kmalloc_caches[KMALLOC_NR_CACHES];        // kmalloc power-of-two caches
+
+const char *kmalloc_names[KMALLOC_NR_CACHES] = {
+    "kmalloc-8", "kmalloc-16", "kmalloc-32", "kmalloc-64", "kmalloc-128",
+    "kmalloc-256", "kmalloc-512", "kmalloc-1024", "kmalloc-2048"
+};
+
+
+
+/* ====== PRIVATE kmem functions ====== */
+
+// Compute object stride, slab order and objects per slab of a cache
+static void __cache_setup(kmem_cache_t *cache, const char *name, uint32_t size, uint32_t flags)
+{
+    uint32_t align;
+
+    // every free object holds the freelist link
+    if (size < sizeof(void *))
+        size = sizeof(void *);
+
+    align = (flags & KMEM_HWCACHE_ALIGN) ? CACHE_LINE_SIZE : sizeof(void *);
+
+    cache->name = name;
+    cache->objsize = size;
+    cache->size = ALIGN(size, align);
+    cache->flags = flags;
+    cache->offset = ALIGN(sizeof(kmem_slab_t), CACHE_LINE_SIZE);
+    cache->slabs_partial = cache->slabs_full = cache->slabs_free = NULL;
+
+    for (cache->order=0; cache->order<KMEM_SLAB_MAX_ORDER; cache->order++) {
+        cache->nobjs = ((PAGE_SIZE << cache->order) - cache->offset) / cache->size;
+        if (cache->nobjs >= KMEM_SLAB_MIN_OBJS)
+            break;
+    }
+    cache->nobjs = ((PAGE_SIZE << cache->order) - cache->offset) / cache->size;
+
+    KASSERT(cache->nobjs > 0);
+}
+
+
+// Get the slab an object belongs to
+static inline kmem_slab_t *__obj_to_slab(void *obj)
+{
+    frame_t *frame;
+
+    frame = VIRT_TO_FRAME(obj);
+    KASSERT(frame->state == FRAME_SLAB);
+
+    return (kmem_slab_t *)FRAME_TO_VIRT(&kframelist[frame->next]);
+}
+
+
+// Allocate a new slab from the buddy allocator and chain its objects
+// arg2: 0 or ALLOC_NORECLAIM
+static kmem_slab_t *__slab_grow(kmem_cache_t *cache, uint32_t flags)
+{
+    kmem_slab_t *slab;
+    frame_t *frame;
+    uint8_t *obj;
+    uint32_t i;
+
+    frame = mem__alloc_pages(cache->order, ALLOC_NORMAL | flags);
+    if (frame == NULL)
+        return NULL;
+
+    for (i=0; i<(1U << cache->order); i++) {
+        frame[i].state = FRAME_SLAB;
+        frame[i].next = FRAME_INDEX(frame);
+    }
+
+    slab = (kmem_slab_t *)FRAME_TO_VIRT(frame);
+    slab->cache = cache;
+    slab->inuse = 0;
+
+    obj = (uint8_t *)slab + cache->offset;
+    slab->freelist = obj;
+    for (i=0; i<cache->nobjs-1; i++) {
+        *(void **)obj = obj + cache->size;
+        obj += cache->size;
+    }
+    *(void **)obj = NULL;
+
+    return slab;
+}
+
+
+// Give the frames of an empty slab back to the buddy allocator
+static void __slab_destroy(kmem_cache_t *cache, kmem_slab_t *slab)
+{
+    mem__free_pages(VIRT_TO_FRAME(slab), cache->order);
+}
+
+
+
+/* ====== PUBLIC kmem functions ====== */
+
+// Init the cache of caches and the kmalloc caches
+void kmem__init(void)
+{
+    uint32_t i;
+
+    kmem_caches = NULL;
+    __cache_setup(&kmem_cache_cache, "kmem_cache", sizeof(kmem_cache_t), KMEM_HWCACHE_ALIGN);
+    DL_APPEND(kmem_caches, &kmem_cache_cache);
+
+    for (i=0; i<KMALLOC_NR_CACHES; i++) {
+        kmalloc_caches[i] = kmem__cache_create(kmalloc_names[i], 1 << (i + KMALLOC_MIN_SHIFT), 0);
+        KASSERT(kmalloc_caches[i] != NULL);
+    }
+}
+
+
+// Create a cache of objects of the given size
+// ret: the new cache or NULL when out of memory
+kmem_cache_t *kmem__cache_create(const char *name, uint32_t size, uint32_t flags)
+{
+    kmem_cache_t *cache;
+    uint32_t state;
+
+    if ((size == 0) || (size > (PAGE_SIZE << KMEM_SLAB_MAX_ORDER) / 2))
+        return NULL;
+
+    cache = kmem__cache_alloc(&kmem_cache_cache);
+    if (cache == NULL)
+        return NULL;
+
+    __cache_setup(cache, name, size, flags);
+
+    state = int__irqsave();
+    DL_APPEND(kmem_caches, cache);
+    int__irqrestore(state);
+
+    return cache;
+}
+
+
+// Destroy a cache, all its objects must be already freed
+void kmem__cache_destroy(kmem_cache_t *cache)
+{
+    kmem_slab_t *slab, *tmp;
+    uint32_t state;
+
+    KASSERT(cache->slabs_partial == NULL);
+    KASSERT(cache->slabs_full == NULL);
+
+    state = int__irqsave();
+
+    DL_FOREACH_SAFE(cache->slabs_free, slab, tmp) {
+        DL_DELETE(cache->slabs_free, slab);
+        __slab_destroy(cache, slab);
+    }
+    DL_DELETE(kmem_caches, cache);
+
+    int__irqrestore(state);
+
+    kmem__cache_free(&kmem_cache_cache, cache);
+}
+
+
+// Allocate an object from a cache
+// ret: the object or NULL when out of memory
+void *kmem__cache_alloc(kmem_cache_t *cache)
+{
+    kmem_slab_t *slab;
+    uint32_t state;
+    void *obj;
+
+    state = int__irqsave();
+
+    slab = cache->slabs_partial;
+    if (slab == NULL) {
+        slab = cache->slabs_free;
+        if (slab != NULL) {
+            DL_DELETE(cache->slabs_free, slab);
+        }
+        else {
+            // out of memory: reclaim with the interrupts restored, the new
+            // slab is not in the cache lists yet
+            slab = __slab_grow(cache, ALLOC_NORECLAIM);
+            if (slab == NULL) {
+                int__irqrestore(state);
+                slab = __slab_grow(cache, 0);
+                if (slab == NULL)
+                    return NULL;
+                state = int__irqsave();
+            }
+        }
+        DL_PREPEND(cache->slabs_partial, slab);
+    }
+
+    obj = slab->freelist;
+    slab->freelist = *(void **)obj;
+    slab->inuse++;
+
+    if (slab->freelist == NULL) {
+        DL_DELETE(cache->slabs_partial, slab);
+        DL_PREPEND(cache->slabs_full, slab);
+    }
+
+    int__irqrestore(state);
+    return obj;
+}
+
+
+// Give back an object to its cache
+void kmem__cache_free(kmem_cache_t *cache, void *obj)
+{
+    kmem_slab_t *slab;
+    uint32_t state;
+    bool was_full;
+
+    slab = __obj_to_slab(obj);
+    KASSERT(slab->cache == cache);
+
+    state = int__irqsave();
+
+    was_full = (slab->freelist == NULL);
+    *(void **)obj = slab->freelist;
+    slab->freelist = obj;
+    slab->inuse--;
+
+    if (slab->inuse == 0) {
+        if (was_full)
+            DL_DELETE(cache->slabs_full, slab);
+        else
+            DL_DELETE(cache->slabs_partial, slab);
+
+        // keep one empty slab for the next allocations, release the others
+        if (cache->slabs_free == NULL)
+            DL_PREPEND(cache->slabs_free, slab);
+        else
+            __slab_destroy(cache, slab);
+    }
+    else if (was_full) {
+        DL_DELETE(cache->slabs_full, slab);
+        DL_PREPEND(cache->slabs_partial, slab);
+    }
+
+    int__irqrestore(state);
+}
+
+
+void kmem__dump_caches(void)
+{
+    kmem_cache_t *cache;
+    kmem_slab_t *slab;
+    uint32_t nslabs, nobjs;
+
+    console__printf("Kmem caches:\n");
+    DL_FOREACH(kmem_caches, cache) {
+        nslabs = nobjs = 0;
+        DL_FOREACH(cache->slabs_partial, slab) {
+            nslabs++;
+            nobjs += slab->inuse;
+        }
+        DL_FOREACH(cache->slabs_full, slab) {
+            nslabs++;
+            nobjs += slab->inuse;
+        }
+        DL_FOREACH(cache->slabs_free, slab) {
+            nslabs++;
+        }
+        console__printf("%s size=%d order=%d objs=%d/%d\n",
+                        cache->name, cache->size, cache->order, nobjs, nslabs * cache->nobjs);
+    }
+}
+
+
+// Allocate size bytes from the smallest fitting power-of-two cache
+// ret: the memory or NULL if size is bigger than KMALLOC_MAX_SIZE or out of memory
+void *kmalloc(size_t size)
+{
+    uint32_t i;
+
+    if (size > KMALLOC_MAX_SIZE)
+        return NULL;
+
+    // index of the smallest power of two >= size
+    if (size <= (1 << KMALLOC_MIN_SHIFT))
+        i = 0;
+    else
+        i = 32 - __builtin_clz(size - 1) - KMALLOC_MIN_SHIFT;
+
+    return kmem__cache_alloc(kmalloc_caches[i]);
+}
+
+
+// Free memory allocated with kmalloc()
+void kfree(void *obj)
+{
+    if (obj == NULL)
+        return;
+
+    kmem__cache_free(__obj_to_slab(obj)->cache, obj);
+}
@@ -29,6 +29,8 @@
 #include "mem.h"
 #include "int_vectors.h"
 #include "int.h"
+#include "vmm.h"
+#include "bootmem.h"
 #include "utlist.h"
 
 
@@ -38,12 +40,29 @@
 gdt_t  kgdt[GDT_NUMBERS];               // GDT
 gdtr_t kgdtr;                           // GDTR
 
-uint32_t *kpage_dir;                    // Page directory
-uint32_t *kpage_tab;                    // Page Table
+pte_t *kpage_dir;                       // Page directory (PAE: the 4 directories seen as one)
+pte_t *kpage_tab;                       // First Page Table (NULL with 4Mb pages)
+#if CONFIG_PAGING_PAE
+uint64_t *kpage_pdpt;                   // Page directory pointer table (PAE)
+#endif
 
 uint32_t    nb_frames;                  // Total number of frames
+uint32_t    nb_lowmem_frames;           // Number of frames in the direct map
 frame_t *   kframelist;                 // Frame list
-free_area_t free_area[BUDDY_MAX_ORDER];
+zone_t      zones[NR_ZONES];            // Buddy allocators (DMA, direct map and highmem)
+zero_pool_t zero_pool;                  // Pre-zeroed frames
+uint32_t    kmap_slots[KMAP_SLOTS / 32];  // Used kmap slots bitmap
+pte_t *     kmap_ptes;                  // Page table entries of the kmap slots
+mem_range_t mem_ranges[MEM_MAX_RANGES];  // Free physical memory ranges found at boot (sorted)
+uint32_t    nb_mem_ranges;
+mem_range_t dma_region;                 // Contiguous DMA region (frame indexes, used by dma.c)
+bool cpu_sse2;                          // movnti available to clear pages
+bool cpu_tsc;                           // rdtsc available (allocator latencies)
+#if CONFIG_MEM_STATS
+mem_stats_t mem_stats;                  // allocator counters (free block counts are in the zones)
+#endif
+bool paging_pse;                        // Direct map uses 4Mb pages (CR4.PSE enabled)
+bool paging_pge;                        // Kernel mappings are global (CR4.PGE enabled)
 
 
 
@@ -64,6 +83,10 @@ void isr_pagefault(uint8_t irq, uint32_t *regs)
 
     error_code = (uint32_t)regs[REG_ERRCODE];
 
+    // demand paging: resolved faults resume the faulting code
+    if (vmm__handle_fault(faulting_address, error_code))
+        return;
+
     // Decode information from the error code
     present  = (uint8_t)!(error_code & 0x1);
     rw       = (uint8_t)(error_code & 0x2);
@@ -128,143 +151,591 @@ static inline void __load_gdt(void)
 }
 
 
-// Extract memory layout info from multiboot struct filled at boot by GRUB
-static void __get_multiboot_info(multiboot_info_t *mbi, memphy_layout_t *layout)
+// End of the available memory that goes on from start (adjacent available
+// regions of the memory map are joined), within the boot map
+static uint32_t __available_end(multiboot_info_t *mbi, uint32_t start)
 {
-    extern uint32_t __TEXT_START, __BSS_END;
-    layout->memsize_kb = 1024 + (uint32_t)mbi->mem_upper;
-    layout->memsize_nframes = layout->memsize_kb / (PAGE_SIZE/1024);
-    layout->phyaddr_kernel_start = ALIGN_PAGE((uint32_t) &__TEXT_START);
-    layout->phyaddr_kernel_end = ALIGN_PAGE((uint32_t) &__BSS_END);
+    memory_map_t *mmap;
+    uint64_t base, end, limit;
+    bool grown;
+
+    if (!CHECK_FLAG (mbi->flags, 6)) {
+        limit = (1024 + (uint64_t)mbi->mem_upper) * 1024;
+        return (limit < BOOT_MAP_SIZE) ? (uint32_t)limit : BOOT_MAP_SIZE;
+    }
+
+    limit = start;
+    do {
+        grown = false;
+        for (mmap = (memory_map_t *) PHYS_TO_VIRT(mbi->mmap_addr);
+             VIRT_TO_PHYS(mmap) < mbi->mmap_addr + mbi->mmap_length;
+             mmap = (memory_map_t *) ((uint32_t) mmap + mmap->size + sizeof (mmap->size)))
+        {
+            base = ((uint64_t)mmap->base_addr_high << 32) | mmap->base_addr_low;
+            end = base + (((uint64_t)mmap->length_high << 32) | mmap->length_low);
+            if (((uint32_t)mmap->type == 1) && (base <= limit) && (end > limit)) {
+                limit = end;
+                grown = true;
+            }
+        }
+    } while (grown && (limit < BOOT_MAP_SIZE));
+
+    return (limit < BOOT_MAP_SIZE) ? (uint32_t)limit : BOOT_MAP_SIZE;
 }
 
 
-static void __init_freearea()
+// Extract memory layout info from multiboot struct filled at boot by GRUB
+static void __get_multiboot_info(multiboot_info_t *mbi, memphy_layout_t *layout)
 {
-    uint32_t i;
+    extern uint32_t __TEXT_START, __KERNEL_END;
+    memory_map_t *mmap;
+    uint64_t end, mem_end;
+    uint32_t max_frames;
+
+    layout->phyaddr_kernel_start = ALIGN_PAGE(VIRT_TO_PHYS(&__TEXT_START));
+    layout->phyaddr_kernel_end = ALIGN_PAGE(VIRT_TO_PHYS(&__KERNEL_END));
+    layout->phyaddr_arena_end = __available_end(mbi, layout->phyaddr_kernel_end) & PAGE_MASK;
+
+    // the end of the last available region (high words included), else mem_upper
+    mem_end = (1024 + (uint64_t)mbi->mem_upper) * 1024;
+    if (CHECK_FLAG (mbi->flags, 6)) {
+        for (mmap = (memory_map_t *) PHYS_TO_VIRT(mbi->mmap_addr);
+             VIRT_TO_PHYS(mmap) < mbi->mmap_addr + mbi->mmap_length;
+             mmap = (memory_map_t *) ((uint32_t) mmap + mmap->size + sizeof (mmap->size)))
+        {
+            end = (((uint64_t)mmap->base_addr_high << 32) | mmap->base_addr_low) +
+                  (((uint64_t)mmap->length_high << 32) | mmap->length_low);
+            if (((uint32_t)mmap->type == 1) && (end > mem_end))
+                mem_end = end;
+        }
+    }
 
-    for (i=0; i<BUDDY_MAX_ORDER; i++) {
-        free_area[i].free_list = NULL;
-        free_area[i].map = 0;
+    // the frame list and the buddy bitmaps (about 1 byte per frame) must fit in the boot arena:
+    // with PAE (64Mb boot map) that is about 28Gb of memory, not the 64Gb of the frame index
+    max_frames = (layout->phyaddr_arena_end - layout->phyaddr_kernel_end) / (sizeof(frame_t) + 1);
+    if (max_frames > MAX_FRAMES)
+        max_frames = MAX_FRAMES;
+
+    if ((mem_end >> PAGE_SHIFT) > max_frames) {
+        console__printf("Memory above %d Mb is not used\n", max_frames >> (20 - PAGE_SHIFT));
+        mem_end = (uint64_t)max_frames << PAGE_SHIFT;
     }
+
+    layout->memsize_nframes = (uint32_t)(mem_end >> PAGE_SHIFT);
+    layout->memsize_kb = layout->memsize_nframes * (PAGE_SIZE/1024);
 }
 
 
-static void __init_framelist(uint32_t nframes, uint32_t kernel_end_addr)
+// Init the zones and their buddy free areas (the order bitmaps come from the boot arena)
+static void __init_zones(void)
 {
-    uint32_t i;
+    uint32_t i, z;
+    uint32_t nwords;
+    zone_t *zone;
+
+    zones[ZONE_DMA].start = 0;
+    zones[ZONE_DMA].end = (nb_lowmem_frames < FRAME(ZONE_DMA_SIZE)) ? nb_lowmem_frames : FRAME(ZONE_DMA_SIZE);
+    zones[ZONE_DMA].reserve = ZONE_DMA_RESERVE;
+    zones[ZONE_NORMAL].start = zones[ZONE_DMA].end;
+    zones[ZONE_NORMAL].end = nb_lowmem_frames;
+    zones[ZONE_NORMAL].reserve = 0;
+    zones[ZONE_HIGHMEM].start = nb_lowmem_frames;
+    zones[ZONE_HIGHMEM].end = nb_frames;
+    zones[ZONE_HIGHMEM].reserve = 0;
+
+    for (z=0; z<NR_ZONES; z++) {
+        zone = &zones[z];
+        zone->nr_free = 0;
+        KASSERT((zone->start == zone->end) || ((zone->start & ((1 << (BUDDY_MAX_ORDER-1)) - 1)) == 0));
+
+        for (i=0; i<BUDDY_MAX_ORDER; i++) {
+            zone->free_area[i].free_list = FRAME_NONE;
+            zone->free_area[i].nr_free = 0;
+            zone->free_area[i].map = NULL;
+
+            // the last order has no buddies to merge with
+            if (i == BUDDY_MAX_ORDER-1)
+                continue;
+
+            nwords = (((zone->end - zone->start) >> (i+1)) + 32) / 32;
+            zone->free_area[i].map = BOOTMEM_ALLOC(uint32_t, nwords);
+            memset(zone->free_area[i].map, 0, nwords * sizeof(uint32_t));
+        }
+    }
+}
 
+
+// The frame list is not cleared: the metadata of a frame is only defined
+// for the first frame of a buddy block, or once the frame has been allocated
+// (kernel ranges here, slabs in kmem) - so boot time does not grow with memory size
+static void __init_framelist(uint32_t nframes)
+{
     nb_frames = nframes;                        // number of frame pages
-    kframelist = (frame_t *) kernel_end_addr;   // frame list init
-    for (i=0; i<nb_frames; i++) {
-        kframelist[i].state = FRAME_UNDEF;
-        kframelist[i].next = kframelist[i].prev = NULL;
+    nb_lowmem_frames = (nframes < FRAME(LOWMEM_SIZE)) ? nframes : FRAME(LOWMEM_SIZE);
+    kframelist = BOOTMEM_ALLOC(frame_t, nframes);
+}
+
+
+// Add the frames [start, end) to the free ranges, overlapping ranges are merged
+static void __range_add(uint32_t start, uint32_t end)
+{
+    uint32_t i, j;
+
+    if (start >= end)
+        return;
+
+    // first range that ends at or after start
+    for (i=0; (i < nb_mem_ranges) && (mem_ranges[i].end < start); i++)
+        ;
+
+    // merge all the ranges touching [start, end)
+    for (j=i; (j < nb_mem_ranges) && (mem_ranges[j].start <= end); j++) {
+        if (mem_ranges[j].start < start)
+            start = mem_ranges[j].start;
+        if (mem_ranges[j].end > end)
+            end = mem_ranges[j].end;
+    }
+
+    if (i == j) {
+        if (nb_mem_ranges == MEM_MAX_RANGES) {
+            console__printf("Error: __range_add() too many memory ranges, 0x%x - 0x%x lost\n", start, end);
+            return;
+        }
+        memmove(&mem_ranges[i+1], &mem_ranges[i], (nb_mem_ranges - i) * sizeof(mem_range_t));
+        nb_mem_ranges++;
+    }
+    else if (j > i+1) {
+        memmove(&mem_ranges[i+1], &mem_ranges[j], (nb_mem_ranges - j) * sizeof(mem_range_t));
+        nb_mem_ranges -= (j - i - 1);
     }
+
+    mem_ranges[i].start = start;
+    mem_ranges[i].end = end;
 }
 
 
-static uint32_t *__get_kframe(void)
+// Remove the frames [start, end) from the free ranges
+static void __range_remove(uint32_t start, uint32_t end)
 {
     uint32_t i;
 
-    for (i=0; i<nb_frames; i++) {
-        if (kframelist[i].state == FRAME_KERNEL) {
-            kframelist[i].state = FRAME_KUSED;
-            return ((uint32_t *)(i * PAGE_SIZE));
+    i = 0;
+    while (i < nb_mem_ranges) {
+        if ((mem_ranges[i].end <= start) || (mem_ranges[i].start >= end)) {
+            i++;
+            continue;
+        }
+
+        // hole in the middle: split the range in two
+        if ((mem_ranges[i].start < start) && (mem_ranges[i].end > end)) {
+            if (nb_mem_ranges == MEM_MAX_RANGES) {
+                mem_ranges[i].end = start;      // drop the upper part
+                return;
+            }
+            memmove(&mem_ranges[i+1], &mem_ranges[i], (nb_mem_ranges - i) * sizeof(mem_range_t));
+            nb_mem_ranges++;
+            mem_ranges[i].end = start;
+            mem_ranges[i+1].start = end;
+            return;
         }
-    }
 
-    // out of memory
-    console__printf("Fatal Error [Out of memory]: no Kernel Frame available !\n");
-    hlt();
-    return NULL;
+        if (mem_ranges[i].start < start) {
+            mem_ranges[i].end = start;
+            i++;
+        }
+        else if (mem_ranges[i].end > end) {
+            mem_ranges[i].start = end;
+            i++;
+        }
+        else {
+            memmove(&mem_ranges[i], &mem_ranges[i+1], (nb_mem_ranges - i - 1) * sizeof(mem_range_t));
+            nb_mem_ranges--;
+        }
+    }
 }
 
 
+// Set the state of every frame of a (small) kernel region
 static void __set_frame_state(uint32_t start, uint32_t len, frame_state_t state)
 {
     uint32_t i;
 
-/***
-    console__printf("__set_frame_state: 0x%x - 0x%x (%d)\n", start, start+len, state);
-***/
-
     if (FRAME(start+len-1) >= nb_frames) {
         console__printf("Error [Out of memory]: __set_frame_state() frame >= nb_frames\n");
         return;
     }
 
-    if (state == FRAME_AVAIL) {
-        for (i=start; i<(start+len); i+=PAGE_SIZE) {
-            if (kframelist[FRAME(i)].state != FRAME_UNDEF) {
-                console__printf("Error: __set_frame_state() frame %d (addr 0x%x) state already defined\n", FRAME(i), i);
-                return;
+    for (i=FRAME(start); i<=FRAME(start+len-1); i++) {
+        kframelist[i].state = state;
+        kframelist[i].next = kframelist[i].prev = FRAME_NONE;
+    }
+}
+
+
+// Write a page table entry, with PAE the high word is written first
+// so that the entry never looks present with a partial address
+static inline void __set_pte(pte_t *pte, pte_t val)
+{
+#if CONFIG_PAGING_PAE
+    ((volatile uint32_t *)pte)[1] = (uint32_t)(val >> 32);
+    ((volatile uint32_t *)pte)[0] = (uint32_t)val;
+#else
+    *(volatile pte_t *)pte = val;
+#endif
+}
+
+
+// Clear a page table entry, with PAE the present bit goes first
+static inline void __clear_pte(pte_t *pte)
+{
+#if CONFIG_PAGING_PAE
+    ((volatile uint32_t *)pte)[0] = 0;
+    ((volatile uint32_t *)pte)[1] = 0;
+#else
+    *(volatile pte_t *)pte = 0;
+#endif
+}
+
+
+// Insert a block at the head of a free list
+static inline void __flist_add(free_area_t *area, uint32_t index)
+{
+    kframelist[index].prev = FRAME_NONE;
+    kframelist[index].next = area->free_list;
+    if (area->free_list != FRAME_NONE)
+        kframelist[area->free_list].prev = index;
+    area->free_list = index;
+    area->nr_free++;
+}
+
+
+// Remove a block from a free list
+static inline void __flist_del(free_area_t *area, uint32_t index)
+{
+    frame_t *frame = &kframelist[index];
+
+    if (frame->prev == FRAME_NONE)
+        area->free_list = frame->next;
+    else
+        kframelist[frame->prev].next = frame->next;
+
+    if (frame->next != FRAME_NONE)
+        kframelist[frame->next].prev = frame->prev;
+    area->nr_free--;
+}
+
+
+#if CONFIG_MEM_STATS
+// Account the cycles spent since start in a latency histogram
+static inline void __stats_latency(uint32_t *hist, uint64_t start)
+{
+    if (cpu_tsc)
+        hist[ilog2((uint32_t)(rdtsc() - start))]++;
+}
+#endif
+
+
+// Flip the bit of a buddy pair and return its previous value
+static inline bool __test_and_change_bit(uint32_t nr, uint32_t *map)
+{
+    uint32_t mask = 1 << (nr & 31);
+    bool old = (map[nr >> 5] & mask) != 0;
+
+    map[nr >> 5] ^= mask;
+    return old;
+}
+
+
+// Zone of a frame
+static inline zone_t *__frame_zone(uint32_t index)
+{
+    if (index >= zones[ZONE_HIGHMEM].start)
+        return &zones[ZONE_HIGHMEM];
+    if (index >= zones[ZONE_NORMAL].start)
+        return &zones[ZONE_NORMAL];
+    return &zones[ZONE_DMA];
+}
+
+
+// Allocate a block of 2^order contiguous frames from a zone
+// arg3: the zone is a fallback, its reserve can't be used
+// ret: first frame of the block or NULL if no block is available
+static frame_t *__zone_alloc_pages(zone_t *zone, uint32_t order, bool fallback)
+{
+    uint32_t state;
+    uint32_t curr;
+    uint32_t index;
+    uint32_t buddy;
+
+    if (order >= BUDDY_MAX_ORDER)
+        return NULL;
+
+    state = int__irqsave();
+
+    if (fallback && (zone->nr_free < zone->reserve + (1 << order))) {
+        int__irqrestore(state);
+        return NULL;
+    }
+
+    // look for the smallest order with a free block
+    for (curr=order; curr<BUDDY_MAX_ORDER; curr++) {
+        if (zone->free_area[curr].free_list != FRAME_NONE)
+            break;
+    }
+
+    if (curr == BUDDY_MAX_ORDER) {
+        int__irqrestore(state);
+        return NULL;
+    }
+
+    index = zone->free_area[curr].free_list;
+    __flist_del(&zone->free_area[curr], index);
+    if (curr != BUDDY_MAX_ORDER-1)
+        __test_and_change_bit((index - zone->start) >> (curr+1), zone->free_area[curr].map);
+
+    // split the block, the upper halves go back to the lower orders
+    while (curr > order) {
+        curr--;
+        buddy = index + (1 << curr);
+        kframelist[buddy].state = FRAME_AVAIL;
+        kframelist[buddy].order = curr;
+        __flist_add(&zone->free_area[curr], buddy);
+        __test_and_change_bit((index - zone->start) >> (curr+1), zone->free_area[curr].map);
+#if CONFIG_MEM_STATS
+        mem_stats.splits++;
+#endif
+    }
+
+    kframelist[index].state = FRAME_USED;
+    kframelist[index].order = order;
+    kframelist[index].refcount = 0;
+    zone->nr_free -= (1 << order);
+
+    int__irqrestore(state);
+    return &kframelist[index];
+}
+
+
+// Give the free ranges to the buddy allocators, each range is split
+// in the biggest aligned blocks that don't cross a zone
+static void __init_buddy(void)
+{
+    uint32_t i, start, end, limit, order;
+
+    for (i=0; i<nb_mem_ranges; i++) {
+        start = mem_ranges[i].start;
+        end = mem_ranges[i].end;
+
+        while (start < end) {
+            // a range across zones is split at the zone ends
+            limit = __frame_zone(start)->end;
+            if (limit > end)
+                limit = end;
+
+            for (order=BUDDY_MAX_ORDER-1; order>0; order--) {
+                if (((start & ((1 << order) - 1)) == 0) && ((start + (1 << order)) <= limit))
+                    break;
             }
+            mem__free_pages(&kframelist[start], order);
+            start += (1 << order);
         }
     }
+}
 
-    for (i=start; i<(start+len); i+=PAGE_SIZE) {
-        kframelist[FRAME(i)].state = state;
-    }
-
-    if (state == FRAME_AVAIL) {
-        uint32_t j;
-        uint32_t num_frames, current_frame, order, frames_per_order, num_order;
-        num_frames = FRAME(len);            // number of frames in the memory region
-        current_frame = FRAME(start);       // first frame in the memory region
-        for (i=BUDDY_MAX_ORDER; i>0; i--) {
-            order = i - 1;
-            frames_per_order = 1 << order;
-            num_order = num_frames >> order; 
-            if (num_order > 0) {
-                for (j=0; j<num_order; j++) {
-                    DL_APPEND(free_area[order].free_list, &kframelist[current_frame+j*frames_per_order]);
-                }
-                current_frame += num_order*frames_per_order;
-                num_frames -= num_order*frames_per_order;
-            }
+
+// Number of page tables needed to map the direct map with 4Kb pages
+static inline uint32_t __nb_physmem_ptabs(void)
+{
+    return (nb_lowmem_frames + PTRS_PER_PT-1) / PTRS_PER_PT;
+}
+
+
+// Map the physical memory in the direct map with 4Kb pages,
+// ptabs points to __nb_physmem_ptabs() contiguous page tables
+static void __map_physmem_4k(pte_t *ptabs)
+{
+    pte_t *ptab;
+    uint32_t global;
+    uint32_t i;
+
+    kpage_tab = ptabs;
+    global = paging_pge ? PAGE_GLOBAL : 0;
+
+    ptab = ptabs;
+    for (i=0; i<nb_lowmem_frames; i++) {
+        if ((i % PTRS_PER_PT) == 0) {
+            ptab = &ptabs[i];
+            kpage_dir[DIRE(KERNEL_VIRT_BASE + i * PAGE_SIZE)] = VIRT_TO_PHYS(ptab) | PAGE_WRITE | PAGE_PRESENT;
         }
+
+        ptab[i % PTRS_PER_PT] = (i * PAGE_SIZE) | global | PAGE_WRITE | PAGE_PRESENT;
     }
+
+    // clear the unused entries of the last page table
+    for (; (i % PTRS_PER_PT) != 0; i++)
+        ptab[i % PTRS_PER_PT] = 0;
 }
 
 
-static void __dump_free_area()
+// Map the physical memory in the direct map with large pages (no page table needed)
+static void __map_physmem_pse(void)
 {
+    uint32_t global;
     uint32_t i;
-    uint32_t count;
-    frame_t *elt;
 
-    console__printf("Free Area list:\n");
-    for (i=0; i<BUDDY_MAX_ORDER; i++) {
-        DL_COUNT(free_area[i].free_list, elt, count);
-        console__printf("Order[%d] num_frame=%d\n", i, count);
+    kpage_tab = NULL;
+    global = paging_pge ? PAGE_GLOBAL : 0;    // kept in the TLB on CR3 reload
+
+    for (i=0; i<nb_lowmem_frames; i+=(LPAGE_SIZE/PAGE_SIZE)) {
+        kpage_dir[DIRE(KERNEL_VIRT_BASE + i * PAGE_SIZE)] =
+            (i * PAGE_SIZE) | PAGE_LARGE | global | PAGE_WRITE | PAGE_PRESENT;
     }
 }
 
 
+static void __dump_free_area()
+{
+    uint32_t i;
+    uint32_t z;
+
+    for (z=0; z<NR_ZONES; z++) {
+        console__printf("Free Area list (%s, %d free frames):\n",
+                        (z == ZONE_DMA) ? "DMA" : (z == ZONE_NORMAL) ? "Normal" : "HighMem", zones[z].nr_free);
+        for (i=0; i<BUDDY_MAX_ORDER; i++)
+            console__printf("Order[%d] num_frame=%d unusable=%d/1000\n",
+                            i, zones[z].free_area[i].nr_free, mem__frag_index(z, i));
+    }
+}
+
+
+// Build the free ranges from the multiboot memory map,
+// the available regions are added first then the reserved ones are cut out
 static void __scan_memory_map(multiboot_info_t *mbi)
 {
-    if (CHECK_FLAG (mbi->flags, 6))
-    {
-        memory_map_t *mmap;
+    memory_map_t *mmap;
+    uint64_t start, end;
+    uint32_t pass;
+
+    nb_mem_ranges = 0;
 
-        for (mmap = (memory_map_t *) mbi->mmap_addr;
-             (uint32_t) mmap < mbi->mmap_addr + mbi->mmap_length;
+    if (!CHECK_FLAG (mbi->flags, 6))
+        return;
+
+    for (pass=0; pass<2; pass++) {
+        for (mmap = (memory_map_t *) PHYS_TO_VIRT(mbi->mmap_addr);
+             VIRT_TO_PHYS(mmap) < mbi->mmap_addr + mbi->mmap_length;
              mmap = (memory_map_t *) ((uint32_t) mmap + mmap->size + sizeof (mmap->size)))
         {
-            if ((uint32_t)mmap->type == 1)
-                __set_frame_state(mmap->base_addr_low, 
-                                  mmap->length_low,
-                                  FRAME_AVAIL);
+            if ((pass == 0) != ((uint32_t)mmap->type == 1))
+                continue;
+
+            start = ((uint64_t)mmap->base_addr_high << 32) | mmap->base_addr_low;
+            end = start + (((uint64_t)mmap->length_high << 32) | mmap->length_low);
+
+            // regions beyond the frame list are clipped
+            if (start >= ((uint64_t)nb_frames << PAGE_SHIFT))
+                continue;
+            if (end > ((uint64_t)nb_frames << PAGE_SHIFT))
+                end = (uint64_t)nb_frames << PAGE_SHIFT;
+
+            // only whole free frames are used, reserved partial frames are excluded
+            if (pass == 0)
+                __range_add((uint32_t)((start + PAGE_SIZE-1) >> PAGE_SHIFT), (uint32_t)(end >> PAGE_SHIFT));
             else
-                __set_frame_state(mmap->base_addr_low, 
-                                  mmap->length_low,
-                                  FRAME_RESERV);
+                __range_remove((uint32_t)(start >> PAGE_SHIFT), (uint32_t)((end + PAGE_SIZE-1) >> PAGE_SHIFT));
         }
     }
 }
 
 
+// Reserve a kernel region: cut it out of the free ranges and set its frames state
+static void __reserve_region(uint32_t start, uint32_t len, frame_state_t state)
+{
+    __range_remove(FRAME(start), FRAME(ALIGN_PAGE(start+len)));
+    __set_frame_state(start, len, state);
+}
+
+
+// Get the size of the contiguous DMA region from the "dma=<size>" option of the command line
+static uint32_t __dma_region_size(multiboot_info_t *mbi)
+{
+    const char *cmdline;
+    uint32_t size;
+
+    if (!CHECK_FLAG (mbi->flags, 2))
+        return DMA_REGION_SIZE;
+
+    for (cmdline = (const char *) PHYS_TO_VIRT(mbi->cmdline); *cmdline != '\0'; cmdline++) {
+        if ((strncmp(cmdline, "dma=", 4) == 0) && ((cmdline == PHYS_TO_VIRT(mbi->cmdline)) || (cmdline[-1] == ' '))) {
+            // saturated on overflow, __init_dma_region() clamps it to the lowmem
+            size = memparse(cmdline + 4, NULL);
+            if (size == UINT32_MAX)
+                console__printf("Warning: dma= size does not fit in 32 bits\n");
+            return size;
+        }
+    }
+
+    return DMA_REGION_SIZE;
+}
+
+
+// Keep the loader data out of the boot arena: the multiboot info,
+// its memory map, the command line and the modules
+static void __reserve_multiboot(multiboot_info_t *mbi, uint32_t mbi_addr)
+{
+    module_t *mod;
+    uint32_t i;
+
+    bootmem__reserve(mbi_addr, sizeof(multiboot_info_t), FRAME_RESERV);
+    if (CHECK_FLAG (mbi->flags, 6))
+        bootmem__reserve(mbi->mmap_addr, mbi->mmap_length, FRAME_RESERV);
+    if (CHECK_FLAG (mbi->flags, 2))
+        bootmem__reserve(mbi->cmdline, strlen((const char *) PHYS_TO_VIRT(mbi->cmdline)) + 1, FRAME_RESERV);
+
+    if (CHECK_FLAG (mbi->flags, 3)) {
+        bootmem__reserve(mbi->mods_addr, mbi->mods_count * sizeof(module_t), FRAME_RESERV);
+        mod = (module_t *) PHYS_TO_VIRT(mbi->mods_addr);
+        for (i=0; i<mbi->mods_count; i++, mod++)
+            bootmem__reserve(mod->mod_start, mod->mod_end - mod->mod_start, FRAME_RESERV);
+    }
+}
+
+
+// Carve the contiguous DMA region out of the free ranges: at the top of
+// the highest direct mapped range that is big enough (the ISA DMA zone is kept)
+static void __init_dma_region(uint32_t size)
+{
+    uint32_t nframes, start, end;
+    int32_t i;
+
+    dma_region.start = dma_region.end = 0;
+
+    // a huge size would wrap around in ALIGN_PAGE()
+    if (size > (nb_lowmem_frames << PAGE_SHIFT))
+        size = nb_lowmem_frames << PAGE_SHIFT;
+
+    nframes = ALIGN_PAGE(size) >> PAGE_SHIFT;
+    if (nframes == 0)
+        return;
+
+    for (i=nb_mem_ranges-1; i>=0; i--) {
+        end = (mem_ranges[i].end < nb_lowmem_frames) ? mem_ranges[i].end : nb_lowmem_frames;
+        if (end < nframes)
+            continue;
+
+        start = (end - nframes) & ~(DMA_REGION_ALIGN - 1);
+        if (start >= mem_ranges[i].start) {
+            __reserve_region(start << PAGE_SHIFT, nframes << PAGE_SHIFT, FRAME_DMA);
+            dma_region.start = start;
+            dma_region.end = start + nframes;
+            return;
+        }
+    }
+
+    console__printf("Error: no room for a %d Kb DMA region\n", nframes * (PAGE_SIZE/1024));
+}
+
+
 
 /* ====== PUBLIC mem functions ====== */
 
@@ -272,7 +743,7 @@ static void __scan_memory_map(multiboot_info_t *mbi)
 void mem__bss_init(void)
 {
     extern uint32_t __BSS_START, __BSS_END;
-    memset(&__BSS_START, '\0', (&__BSS_END - &__BSS_START));
+    memset(&__BSS_START, '\0', (uint32_t)&__BSS_END - (uint32_t)&__BSS_START);
 }
 
 
@@ -298,12 +769,16 @@ void mem__paging_init(uint32_t multiboot_info_addr)
 {
     multiboot_info_t *mbi;
     memphy_layout_t kmemlayout;
-    union addr_u addr;
+    pte_t *ptabs;
+    uint32_t dma_size;
     uint32_t i;
 
-    mbi = (multiboot_info_t *) multiboot_info_addr;
+    mbi = (multiboot_info_t *) PHYS_TO_VIRT(multiboot_info_addr);
 
+    // the loader data can be right after the kernel image: read what
+    // is needed before the boot arena is used
     __get_multiboot_info(mbi, &kmemlayout);
+    dma_size = __dma_region_size(mbi);
 
 /*
     console__printf("Physic Memory Layout:\n");
@@ -315,45 +790,113 @@ void mem__paging_init(uint32_t multiboot_info_addr)
     console__printf("kgdtr addr = 0x%p\n", &kgdtr);
 */
 
-    __init_framelist(kmemlayout.memsize_nframes, kmemlayout.phyaddr_kernel_end);
-
-    __init_freearea();
+    // early data comes from the boot arena: the available memory after
+    // the kernel image, in the boot map
+    bootmem__init(kmemlayout.phyaddr_kernel_end, kmemlayout.phyaddr_arena_end);
+    bootmem__reserve(0x00000000, 0x00020000, FRAME_RESERV);
+    bootmem__reserve(kmemlayout.phyaddr_kernel_start, kmemlayout.phyaddr_kernel_end-kmemlayout.phyaddr_kernel_start, FRAME_KUSED);
+    __reserve_multiboot(mbi, multiboot_info_addr);
+
+    __init_framelist(kmemlayout.memsize_nframes);
+    __init_zones();
+
+#if CONFIG_PAGING_PAE
+    paging_pse = true;                          // 2Mb pages are always available with PAE
+#elif CONFIG_PAGING_PSE
+    paging_pse = cpu_has_feature(CPUID_FEAT_EDX_PSE);
+#else
+    paging_pse = false;
+#endif
+#if CONFIG_PAGING_PGE
+    paging_pge = cpu_has_feature(CPUID_FEAT_EDX_PGE);
+#else
+    paging_pge = false;
+#endif
+
+    // the page directory comes from the boot arena too (the buddy frames
+    // may be out of the boot map), the PDPT needs a 32 bytes alignment
+    kpage_dir = bootmem__alloc(PTRS_PER_PD * PTE_SIZE, PAGE_SIZE, FRAME_KUSED);
+#if CONFIG_PAGING_PAE
+    kpage_pdpt = bootmem__alloc(PDPT_ENTRIES * sizeof(uint64_t), 32, FRAME_KUSED);
+#endif
+
+    // without large pages the direct map needs page tables
+    ptabs = NULL;
+    if (!paging_pse)
+        ptabs = bootmem__alloc(__nb_physmem_ptabs() * PAGE_SIZE, PAGE_SIZE, FRAME_KUSED);
 
 
     __scan_memory_map(mbi);
 
-    __set_frame_state(0x00000000, 0x00020000, FRAME_RESERV);
-    __set_frame_state(kmemlayout.phyaddr_kernel_start, KERNEL_RESERVED_MEM, FRAME_KERNEL);
-    __set_frame_state(kmemlayout.phyaddr_kernel_start, kmemlayout.phyaddr_kernel_end-kmemlayout.phyaddr_kernel_start, FRAME_KUSED);
-    __set_frame_state((uint32_t)kframelist, (uint32_t)nb_frames*sizeof(frame_t), FRAME_KUSED);  
+    // the boot arena regions are cut out of the free ranges
+    bootmem__handover(__reserve_region);
+    __init_dma_region(dma_size);
+
+    // all the reservations are done, the remaining free ranges go to the buddy allocator
+    __init_buddy();
+#if CONFIG_MEM_STATS
+    // the blocks given at boot are not frees
+    memset(&mem_stats, 0, sizeof(mem_stats));
+#endif
+
+    zero_pool.nfree = 0;
+    cpu_sse2 = cpu_has_feature(CPUID_FEAT_EDX_SSE2);
+    cpu_tsc = cpu_has_feature(CPUID_FEAT_EDX_TSC);
 
 /*
     __dump_free_area();
 */
 
-    // * paging: map one-to-one first 4Mb of ram *
-
-    // get 1 frame each for one page dir and one page table (1024*4b)
-    kpage_dir = __get_kframe();
-    kpage_tab = __get_kframe();
-  
-    // init page directory (only 1 descriptor)
-    addr.addr = (uint32_t)kpage_tab;
-    addr.page_dir.r = 1;              // read-write
-    addr.page_dir.p = 1;              // present
-    kpage_dir[0] = addr.addr;
-    for (i=1; i<1024; i++)
+    // * paging: map all the physical memory in the direct map at KERNEL_VIRT_BASE *
+    //   user space (below KERNEL_VIRT_BASE) is left empty
+
+    for (i=0; i<PTRS_PER_PD; i++)
         kpage_dir[i] = 0;
 
-    // Init page table (0x00000000 - 0x00400000)
-    for (i=0; i<1024; i++) {
-        addr.addr = (i * PAGE_SIZE);
-        addr.page_tab.r = 1;
-        addr.page_tab.p = 1;
-        kpage_tab[i] = addr.addr;
+    // the page directory maps itself (one entry for each page of the directory)
+    for (i=0; i<PTRS_PER_PD/PTRS_PER_PT; i++)
+        kpage_dir[SELFMAP_PDE + i] = (VIRT_TO_PHYS(kpage_dir) + i * PAGE_SIZE) | PAGE_WRITE | PAGE_PRESENT;
+
+#if CONFIG_PAGING_PAE
+    // the PDPT entries only have the present bit, rights are in the directories
+    for (i=0; i<PDPT_ENTRIES; i++)
+        kpage_pdpt[i] = (VIRT_TO_PHYS(kpage_dir) + i * PAGE_SIZE) | PAGE_PRESENT;
+#endif
+
+    if (paging_pse) {
+        __map_physmem_pse();
+#if !CONFIG_PAGING_PAE
+        write_cr4(read_cr4() | CR4_PSE);
+#endif
     }
+    else {
+        __map_physmem_4k(ptabs);
+    }
+
+    console__printf("Frame metadata: %d frames, %d Kb (%d bytes per frame)\n",
+                    nb_frames, (nb_frames * sizeof(frame_t)) / 1024, sizeof(frame_t));
+
+    // switch from the boot page directory to the kernel one
+#if CONFIG_PAGING_PAE
+    write_cr3(VIRT_TO_PHYS(kpage_pdpt));
+#else
+    write_cr3(VIRT_TO_PHYS(kpage_dir));
+#endif
+
+    // global pages are enabled once paging is on
+    if (paging_pge)
+        write_cr4(read_cr4() | CR4_PGE);
 
-    EnablePaging();
+    // copy-on-write pages must fault on kernel writes too
+    write_cr0(read_cr0() | CR0_WP);
+
+    // the kmap page table is allocated once, it is shared by all the address spaces
+    kmap_ptes = mem__get_pte(KMAP_BASE, true);
+    KASSERT(kmap_ptes != NULL);
+    memset(kmap_slots, 0, sizeof(kmap_slots));
+
+    if (nb_frames > nb_lowmem_frames)
+        console__printf("HighMem: %d Mb\n", (nb_frames - nb_lowmem_frames) >> (20 - PAGE_SHIFT));
 
 /***
     console__printf("kpage_dir = 0x%x\n", kpage_dir);
@@ -395,3 +938,540 @@ void mem__dump_map(void)
     console__printf("BSS End      = %p\n", (void*)&__BSS_END);
     console__printf("-------------------------\n\n");
 }
+
+
+// Allocate a block of 2^order contiguous frames
+// arg2: ALLOC_* flags, the zone to use first (the lower zones are the fallback)
+// ret: first frame of the block or NULL if no block is available
+frame_t *mem__alloc_pages(uint32_t order, uint32_t flags)
+{
+    frame_t *frame;
+    int32_t z, i;
+#if CONFIG_MEM_STATS
+    uint32_t state;
+    uint64_t start = cpu_tsc ? rdtsc() : 0;
+#endif
+
+    if (flags & ALLOC_DMA)
+        z = ZONE_DMA;
+    else if (flags & ALLOC_HIGHMEM)
+        z = ZONE_HIGHMEM;
+    else
+        z = ZONE_NORMAL;
+
+    frame = __zone_alloc_pages(&zones[z], order, false);
+    for (i=z-1; (frame == NULL) && (i >= 0); i--)
+        frame = __zone_alloc_pages(&zones[i], order, true);
+
+    // out of memory: swap out some anonymous pages from the usable zones and try again
+    if ((frame == NULL) && !(flags & ALLOC_NORECLAIM) && (vmm__reclaim(1 << order, z) > 0)) {
+        frame = __zone_alloc_pages(&zones[z], order, false);
+        for (i=z-1; (frame == NULL) && (i >= 0); i--)
+            frame = __zone_alloc_pages(&zones[i], order, true);
+    }
+
+#if CONFIG_MEM_STATS
+    // under irqsave like the free counters: irq handlers allocate too
+    state = int__irqsave();
+    if (order < BUDDY_MAX_ORDER) {
+        if (frame != NULL)
+            mem_stats.allocs[order]++;
+        else
+            mem_stats.failures[order]++;
+    }
+    __stats_latency(mem_stats.alloc_lat, start);
+    int__irqrestore(state);
+#endif
+
+    return frame;
+}
+
+
+// Free a block of 2^order frames, merging it with its free buddies
+void mem__free_pages(frame_t *frame, uint32_t order)
+{
+    uint32_t state;
+    uint32_t index;
+    zone_t *zone;
+#if CONFIG_MEM_STATS
+    uint64_t start = cpu_tsc ? rdtsc() : 0;
+#endif
+
+    index = FRAME_INDEX(frame);
+    zone = __frame_zone(index);
+    KASSERT(order < BUDDY_MAX_ORDER);
+    KASSERT((index & ((1 << order) - 1)) == 0);
+
+    state = int__irqsave();
+
+    zone->nr_free += (1 << order);
+#if CONFIG_MEM_STATS
+    mem_stats.frees[order]++;
+#endif
+
+    while (order < BUDDY_MAX_ORDER-1) {
+        // the buddy bit was clear: the buddy is in use, stop merging
+        if (!__test_and_change_bit((index - zone->start) >> (order+1), zone->free_area[order].map))
+            break;
+
+        __flist_del(&zone->free_area[order], index ^ (1 << order));
+        index &= ~(1 << order);
+        order++;
+#if CONFIG_MEM_STATS
+        mem_stats.merges++;
+#endif
+    }
+
+    kframelist[index].state = FRAME_AVAIL;
+    kframelist[index].order = order;
+    __flist_add(&zone->free_area[order], index);
+
+#if CONFIG_MEM_STATS
+    __stats_latency(mem_stats.free_lat, start);
+#endif
+    int__irqrestore(state);
+}
+
+
+// Add a mapping to a page shared by address spaces
+// ret: false when the count is saturated (the page must be copied)
+bool mem__page_ref(frame_t *frame)
+{
+    uint32_t state;
+    bool ret;
+
+    state = int__irqsave();
+    ret = (frame->refcount < FRAME_REFCOUNT_MAX);
+    if (ret)
+        frame->refcount++;
+    int__irqrestore(state);
+
+    return ret;
+}
+
+
+// Remove a mapping of a page, the page is freed with its last mapping
+void mem__page_unref(frame_t *frame)
+{
+    uint32_t state;
+
+    state = int__irqsave();
+    if (frame->refcount > 0) {
+        frame->refcount--;
+        frame = NULL;
+    }
+    int__irqrestore(state);
+
+    if (frame != NULL)
+        mem__free_pages(frame, 0);
+}
+
+
+// Clear a page, with non-temporal stores when available so that zeroing
+// pages ahead of time does not evict useful data from the caches
+void mem__clear_page(void *page)
+{
+    uint32_t count;
+
+    if (cpu_sse2) {
+        asm volatile("1:                      \n"
+                     "movnti %%eax,  0(%0)    \n"
+                     "movnti %%eax,  4(%0)    \n"
+                     "movnti %%eax,  8(%0)    \n"
+                     "movnti %%eax, 12(%0)    \n"
+                     "movnti %%eax, 16(%0)    \n"
+                     "movnti %%eax, 20(%0)    \n"
+                     "movnti %%eax, 24(%0)    \n"
+                     "movnti %%eax, 28(%0)    \n"
+                     "addl   $32, %0          \n"
+                     "decl   %1               \n"
+                     "jnz    1b               \n"
+                     "sfence                  \n"
+                     : "+r" (page), "=r" (count)
+                     : "a" (0), "1" (PAGE_SIZE / 32)
+                     : "memory");
+    }
+    else {
+        asm volatile("rep stosl"
+                     : "+D" (page), "=c" (count)
+                     : "a" (0), "1" (PAGE_SIZE / 4)
+                     : "memory");
+    }
+}
+
+
+// Zone of a frame (ZONE_*)
+uint32_t mem__frame_zone(frame_t *frame)
+{
+    return __frame_zone(FRAME_INDEX(frame)) - zones;
+}
+
+
+// Allocate a zeroed frame, from the pre-zeroed pool when possible
+// arg1: 0 or ALLOC_NORECLAIM
+// ret: the frame or NULL if out of memory
+frame_t *mem__alloc_zeroed_page(uint32_t flags)
+{
+    uint32_t state;
+    frame_t *frame;
+
+    state = int__irqsave();
+    if (zero_pool.nfree > 0) {
+        frame = zero_pool.frames[--zero_pool.nfree];
+        int__irqrestore(state);
+        return frame;
+    }
+    int__irqrestore(state);
+
+    frame = mem__alloc_pages(0, ALLOC_NORMAL | (flags & ALLOC_NORECLAIM));
+    if (frame != NULL)
+        mem__clear_page(FRAME_TO_VIRT(frame));
+
+    return frame;
+}
+
+
+// Fill the pre-zeroed pool from the buddy free lists (called when idle,
+// pages are cleared with interrupts enabled)
+void mem__zero_pool_refill(void)
+{
+    uint32_t state;
+    frame_t *frame;
+
+    // the pool is optional: never swap out pages to fill it
+    while (zero_pool.nfree < ZERO_POOL_SIZE) {
+        frame = mem__alloc_pages(0, ALLOC_NORMAL | ALLOC_NORECLAIM);
+        if (frame == NULL)
+            return;
+
+        mem__clear_page(FRAME_TO_VIRT(frame));
+
+        state = int__irqsave();
+        if (zero_pool.nfree < ZERO_POOL_SIZE) {
+            zero_pool.frames[zero_pool.nfree++] = frame;
+            frame = NULL;
+        }
+        int__irqrestore(state);
+
+        if (frame != NULL) {
+            mem__free_pages(frame, 0);
+            return;
+        }
+    }
+}
+
+
+// Allocate a zeroed frame for a user mapping, from highmem when there is some
+// arg1: 0 or ALLOC_NORECLAIM
+// ret: the frame or NULL if out of memory
+frame_t *mem__alloc_zeroed_highpage(uint32_t flags)
+{
+    frame_t *frame;
+    void *vaddr;
+
+    // without highmem the pre-zeroed pool is faster
+    if (zones[ZONE_HIGHMEM].nr_free == 0)
+        return mem__alloc_zeroed_page(flags);
+
+    frame = mem__alloc_pages(0, ALLOC_HIGHMEM | (flags & ALLOC_NORECLAIM));
+    if (frame == NULL)
+        return NULL;
+
+    vaddr = mem__kmap(frame);
+    if (vaddr == NULL) {
+        mem__free_pages(frame, 0);
+        return mem__alloc_zeroed_page(flags);
+    }
+
+    mem__clear_page(vaddr);
+    mem__kunmap(vaddr);
+
+    return frame;
+}
+
+
+// Get a kernel address for a frame: the direct map address or a
+// temporary mapping for highmem frames (released with mem__kunmap)
+// ret: the address or NULL if all the kmap slots are in use
+void *mem__kmap(frame_t *frame)
+{
+    uint32_t state;
+    uint32_t slot;
+    uint32_t vaddr;
+
+    if (!FRAME_IS_HIGH(frame))
+        return FRAME_TO_VIRT(frame);
+
+    state = int__irqsave();
+
+    for (slot=0; slot<KMAP_SLOTS; slot++) {
+        if (!(kmap_slots[slot / 32] & (1 << (slot % 32))))
+            break;
+    }
+
+    if (slot == KMAP_SLOTS) {
+        int__irqrestore(state);
+        return NULL;
+    }
+
+    kmap_slots[slot / 32] |= (1 << (slot % 32));
+    vaddr = KMAP_BASE + slot * PAGE_SIZE;
+
+    // the slot entry was cleared (and flushed) by mem__kunmap
+    __set_pte(&kmap_ptes[slot], FRAME_TO_PHYS(frame) | (paging_pge ? PAGE_GLOBAL : 0) | PAGE_WRITE | PAGE_PRESENT);
+
+    int__irqrestore(state);
+    return (void *)vaddr;
+}
+
+
+// Release an address obtained with mem__kmap()
+void mem__kunmap(void *vaddr)
+{
+    uint32_t state;
+    uint32_t slot;
+
+    if (((uint32_t)vaddr < KMAP_BASE) || ((uint32_t)vaddr >= KMAP_BASE + KMAP_SLOTS * PAGE_SIZE))
+        return;
+
+    slot = ((uint32_t)vaddr - KMAP_BASE) >> PAGE_SHIFT;
+
+    state = int__irqsave();
+
+    __clear_pte(&kmap_ptes[slot]);
+    mem__tlb_flush_page((uint32_t)vaddr);
+    kmap_slots[slot / 32] &= ~(1 << (slot % 32));
+
+    int__irqrestore(state);
+}
+
+
+// Get the page table entry of a virtual address in the current address space,
+// the page tables are reached through the self map
+// arg2: alloc a zeroed page table when missing
+// ret: pointer to the entry or NULL (no page table or large page)
+pte_t *mem__get_pte(uint32_t vaddr, bool alloc)
+{
+    uint32_t state;
+    pte_t *pde;
+    pte_t *ptab;
+    frame_t *frame;
+
+    pde = PDE_VIRT(vaddr);
+    ptab = PTE_VIRT(vaddr & ~(LPAGE_SIZE - 1));
+
+    if (!(*pde & PAGE_PRESENT)) {
+        if (!alloc)
+            return NULL;
+
+        // page tables are never accessed through the direct map, they can be in highmem;
+        // the table is zeroed before the entry makes it visible to the page walker
+        frame = mem__alloc_zeroed_highpage(0);
+        if (frame == NULL)
+            return NULL;
+
+        // the allocation can run with the interrupts enabled (reclaim):
+        // someone else may have set the table meanwhile
+        state = int__irqsave();
+        if (*pde & PAGE_PRESENT) {
+            int__irqrestore(state);
+            mem__free_pages(frame, 0);
+            return (*pde & PAGE_LARGE) ? NULL : PTE_VIRT(vaddr);
+        }
+
+        // access rights are checked on the page table entries
+        if (vaddr < KERNEL_VIRT_BASE)
+            __set_pte(pde, FRAME_TO_PHYS(frame) | PAGE_USER | PAGE_WRITE | PAGE_PRESENT);
+        else
+            __set_pte(pde, FRAME_TO_PHYS(frame) | PAGE_WRITE | PAGE_PRESENT);
+
+        mem__tlb_flush_page((uint32_t)ptab);
+        int__irqrestore(state);
+    }
+    else if (*pde & PAGE_LARGE) {
+        return NULL;
+    }
+
+    return PTE_VIRT(vaddr);
+}
+
+
+// Write a page table entry (64 bits entries are written in the right order)
+void mem__set_pte(pte_t *pte, pte_t val)
+{
+    if (val & PAGE_PRESENT)
+        __set_pte(pte, val);
+    else {
+        __clear_pte(pte);
+        __set_pte(pte, val);
+    }
+}
+
+
+// Map a page at vaddr on the frame at paddr (PAGE_PRESENT is implied)
+// ret: false when the page table can't be allocated
+bool mem__map_page(uint32_t vaddr, phys_addr_t paddr, uint32_t flags)
+{
+    uint32_t state;
+    pte_t *pte;
+
+    // a missing page table is allocated first, not with the interrupts disabled
+    if (mem__get_pte(vaddr, true) == NULL)
+        return false;
+
+    state = int__irqsave();
+
+    pte = mem__get_pte(vaddr, false);
+    if (pte == NULL) {
+        int__irqrestore(state);
+        return false;
+    }
+
+    if ((vaddr >= KERNEL_VIRT_BASE) && paging_pge)
+        flags |= PAGE_GLOBAL;
+
+    // not present entries are never cached in the TLB, no flush needed
+    __set_pte(pte, (paddr & PTE_ADDR_MASK) | (flags & PAGE_FLAGS) | PAGE_PRESENT);
+
+    int__irqrestore(state);
+    return true;
+}
+
+
+// Unmap the page at vaddr
+// ret: the old page table entry (0 if nothing was mapped)
+pte_t mem__unmap_page(uint32_t vaddr)
+{
+    pte_t old;
+
+    old = mem__unmap_page_lazy(vaddr);
+    if (old & PAGE_PRESENT)
+        mem__tlb_flush_page(vaddr);
+
+    return old;
+}
+
+
+// Unmap the page at vaddr without invalidating its TLB entry,
+// the caller flushes the TLB before the address is used again
+// ret: the old page table entry (0 if nothing was mapped, not present
+//      entries like swap entries are cleared and returned too)
+pte_t mem__unmap_page_lazy(uint32_t vaddr)
+{
+    pte_t *pte;
+    pte_t old;
+
+    pte = mem__get_pte(vaddr, false);
+    if ((pte == NULL) || (*pte == 0))
+        return 0;
+
+    old = *pte;
+    __clear_pte(pte);
+
+    return old;
+}
+
+
+// Invalidate the TLB entry of a single page (global or not)
+inline void mem__tlb_flush_page(uint32_t vaddr)
+{
+    asm volatile("invlpg (%0)" : : "r" (vaddr) : "memory");
+}
+
+
+// Invalidate all the non-global TLB entries (kernel mappings survive)
+void mem__tlb_flush(void)
+{
+    write_cr3(read_cr3());
+}
+
+
+// Invalidate all the TLB entries, global ones included (kernel remaps)
+void mem__tlb_flush_global(void)
+{
+    uint32_t state;
+    uint32_t cr4;
+
+    if (paging_pge) {
+        state = int__irqsave();
+        cr4 = read_cr4();
+        write_cr4(cr4 & ~CR4_PGE);
+        write_cr4(cr4);
+        int__irqrestore(state);
+    }
+    else {
+        mem__tlb_flush();
+    }
+}
+
+
+// Take a snapshot of the page allocator statistics
+void mem__get_stats(mem_stats_t *stats)
+{
+    uint32_t state;
+    uint32_t z, i;
+
+    state = int__irqsave();
+
+#if CONFIG_MEM_STATS
+    *stats = mem_stats;
+#else
+    memset(stats, 0, sizeof(*stats));
+#endif
+
+    for (z=0; z<NR_ZONES; z++) {
+        stats->nr_free[z] = zones[z].nr_free;
+        for (i=0; i<BUDDY_MAX_ORDER; i++)
+            stats->free_blocks[z][i] = zones[z].free_area[i].nr_free;
+    }
+
+    int__irqrestore(state);
+}
+
+
+// Unusable free space index of a zone for an order: the part of the free
+// frames (in 1/1000) that is in blocks too small for an allocation of that order
+uint32_t mem__frag_index(uint32_t zone, uint32_t order)
+{
+    uint32_t i, usable, unusable, total;
+
+    total = zones[zone].nr_free;
+    if (total == 0)
+        return 0;
+
+    usable = 0;
+    for (i=order; i<BUDDY_MAX_ORDER; i++)
+        usable += zones[zone].free_area[i].nr_free << i;
+    unusable = total - usable;
+
+    // unusable * 1000 must fit in 32 bits
+    while (total > (1 << 22)) {
+        total >>= 1;
+        unusable >>= 1;
+    }
+
+    return (unusable * 1000) / total;
+}
+
+
+void mem__dump_stats(void)
+{
+    mem_stats_t stats;
+    uint32_t i;
+
+    mem__get_stats(&stats);
+    __dump_free_area();
+
+    console__printf("Page allocator: %d splits, %d merges\n", stats.splits, stats.merges);
+    for (i=0; i<BUDDY_MAX_ORDER; i++) {
+        if (stats.allocs[i] || stats.frees[i] || stats.failures[i])
+            console__printf("Order[%d] alloc=%d free=%d fail=%d\n",
+                            i, stats.allocs[i], stats.frees[i], stats.failures[i]);
+    }
+
+    console__printf("Latency (cycles): alloc / free\n");
+    for (i=0; i<MEM_LAT_BUCKETS; i++) {
+        if (stats.alloc_lat[i] || stats.free_lat[i])
+            console__printf("< 2^%d: %d / %d\n", i+1, stats.alloc_lat[i], stats.free_lat[i]);
+    }
+}
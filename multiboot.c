@@ -26,6 +26,7 @@
 // simOS includes
 #include "multiboot.h"
 #include "console.h"
+#include "mem.h"
 
 
 
@@ -45,8 +46,9 @@ void multiboot__dump_info(uint32_t magic, uint32_t addr)
         return;
     }
 
-    /* Set MBI to the address of the Multiboot information structure. */
-    mbi = (multiboot_info_t *) addr;
+    /* Set MBI to the address of the Multiboot information structure
+       (the bootloader gives its physical address). */
+    mbi = (multiboot_info_t *) PHYS_TO_VIRT(addr);
 
     /* Print out the flags. */
     console__printf("flags = 0x%x\n", (uint32_t)mbi->flags);
@@ -62,7 +64,7 @@ void multiboot__dump_info(uint32_t magic, uint32_t addr)
      
     /* Is the command line passed? */
     if (CHECK_FLAG(mbi->flags, 2))
-        console__printf("cmdline = %s\n", (char *)mbi->cmdline);
+        console__printf("cmdline = %s\n", (char *)PHYS_TO_VIRT(mbi->cmdline));
 
     /* Are mods_* valid? */
     if (CHECK_FLAG(mbi->flags, 3))
@@ -72,13 +74,13 @@ void multiboot__dump_info(uint32_t magic, uint32_t addr)
      
         console__printf("mods_count = %d, mods_addr = 0x%x\n",
                        (int) mbi->mods_count, (int) mbi->mods_addr);
-        for (i = 0, mod = (module_t *) mbi->mods_addr;
+        for (i = 0, mod = (module_t *) PHYS_TO_VIRT(mbi->mods_addr);
              i < mbi->mods_count;
              i++, mod++)
             console__printf(" mod_start = 0x%x, mod_end = 0x%x, cmdline = %s\n",
                             (uint32_t) mod->mod_start,
                             (uint32_t) mod->mod_end,
-                            (char *) mod->string);
+                            (char *) PHYS_TO_VIRT(mod->string));
     }
      
     /* Bits 4 and 5 are mutually exclusive! */
@@ -119,8 +121,8 @@ void multiboot__dump_info(uint32_t magic, uint32_t addr)
         console__printf("MULTIBOOT MEMORY MAP\n");    
         console__printf("mmap_addr = 0x%x, mmap_length = 0x%x\n",
                        (uint32_t) mbi->mmap_addr, (uint32_t) mbi->mmap_length);
-        for (mmap = (memory_map_t *) mbi->mmap_addr;
-             (uint32_t) mmap < mbi->mmap_addr + mbi->mmap_length;
+        for (mmap = (memory_map_t *) PHYS_TO_VIRT(mbi->mmap_addr);
+             VIRT_TO_PHYS(mmap) < mbi->mmap_addr + mbi->mmap_length;
              mmap = (memory_map_t *) ((uint32_t) mmap
                     + mmap->size + sizeof (mmap->size)))
         {
@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) 2013 - Simone Rotondo - http://www.piemontewireless.net/
+ * simOS - tiny x86 kernel
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Deferred interrupt work: the top halves (irq handlers) only acknowledge
+// the device and raise a pending bit, the bottom halves run on the way out
+// of an irq (int_vectors.S irq_common) with interrupts enabled.
+// Under load, after SOFTIRQ_MAX_RESTART rounds, the remaining work is left
+// to the idle loop, the only kernel thread.
+
+// standard includes
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// simOS includes
+#include "utils.h"
+#include "kassert.h"
+#include "int_vectors.h"
+#include "int.h"
+#include "softirq.h"
+
+
+
+/* ====== Globals ====== */
+
+softirq_func_t softirq_vector[NR_SOFTIRQS];     // bottom half handlers
+volatile uint32_t softirq_pending;              // one bit per softirq type
+bool softirq_running;                           // bottom halves running (nested irqs don't start them again)
+
+
+
+/* ====== PRIVATE softirq functions ====== */
+
+// Run the pending bottom halves (called with interrupts disabled)
+// arg: max number of rounds, new bits raised meanwhile start a new round
+static void __do_softirq(uint32_t rounds)
+{
+    uint32_t pending;
+    uint32_t nr;
+
+    softirq_running = true;
+
+    for (; (rounds > 0) && (softirq_pending != 0); rounds--) {
+        pending = softirq_pending;
+        softirq_pending = 0;
+
+        int__irqenable();
+        for (nr=0; pending!=0; nr++, pending>>=1) {
+            if ((pending & 1) && (softirq_vector[nr] != NULL))
+                softirq_vector[nr]();
+        }
+        int__irqdisable();
+    }
+
+    softirq_running = false;
+}
+
+
+
+/* ====== PUBLIC softirq functions ====== */
+
+void softirq__init(void)
+{
+    uint32_t i;
+
+    for (i=0; i<NR_SOFTIRQS; i++)
+        softirq_vector[i] = NULL;
+    softirq_pending = 0;
+    softirq_running = false;
+}
+
+
+void softirq__register(softirq_type_t nr, softirq_func_t handler)
+{
+    KASSERT(nr < NR_SOFTIRQS);
+    softirq_vector[nr] = handler;
+}
+
+
+// Mark a bottom half pending (from a top half or anywhere else)
+void softirq__raise(softirq_type_t nr)
+{
+    uint32_t state;
+
+    state = int__irqsave();
+    softirq_pending |= (1 << nr);
+    int__irqrestore(state);
+}
+
+
+// Interrupt return path: run the bottom halves unless the interrupted code
+// had interrupts disabled or was already running them
+void softirq__irq_exit(uint32_t *regs)
+{
+    if ((softirq_pending == 0) || softirq_running)
+        return;
+    if (!(regs[REG_EFLAGS] & X86_FLAGS_IF))
+        return;
+
+    __do_softirq(SOFTIRQ_MAX_RESTART);
+}
+
+
+// Idle loop: run all the pending bottom halves
+void softirq__run(void)
+{
+    uint32_t state;
+
+    state = int__irqsave();
+    if (!softirq_running)
+        __do_softirq(0xFFFFFFFF);
+    int__irqrestore(state);
+}
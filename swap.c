@@ -0,0 +1,440 @@
+/*
+ * Copyright (C) 2013 - Simone Rotondo - http://www.piemontewireless.net/
+ * simOS - tiny x86 kernel
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Compressed swap store: when the memory is short, vmm__reclaim() compresses
+// cold anonymous pages with a small LZ codec and keeps them here, the page
+// table entry keeps the swap entry until the page is faulted back in.
+// The store is a pool of pages taken from the buddy allocator, each one
+// split in 32 bytes units (one bit per unit). Zero pages take no room.
+
+// standard includes
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// simOS includes
+#include "utils.h"
+#include "kassert.h"
+#include "console.h"
+#include "mem.h"
+#include "int.h"
+#include "swap.h"
+
+
+
+#define POOL_UNITS      (PAGE_SIZE >> SWAP_UNIT_SHIFT)  // units in a store page
+#define POOL_HANDLE(page, unit)  (((page) << 8) | (unit))
+#define HANDLE_PAGE(handle)      ((handle) >> 8)
+#define HANDLE_UNIT(handle)      ((handle) & 0xFF)
+
+#define LZ_HASH_BITS    12
+#define LZ_MIN_MATCH    3
+#define LZ_MAX_MATCH    (LZ_MIN_MATCH + 15)     // 4 bits length
+#define LZ_MAX_OFFSET   (PAGE_SIZE - 1)         // 12 bits offset
+#define LZ_HASH(p)      ((((p)[0] << 8) ^ ((p)[1] << 4) ^ (p)[2]) & ((1 << LZ_HASH_BITS) - 1))
+
+
+// swapped out page
+//   count: page table entries holding the swap entry (0: free slot, handle links the free slots)
+//   len: compressed size (0: zero page, nothing in the store)
+typedef struct swap_slot {
+  uint32_t handle;
+  uint16_t len;
+  uint16_t count;
+} swap_slot_t;
+
+
+// page of the store
+typedef struct swap_pool {
+  uint8_t *page;                        // NULL: not allocated
+  uint32_t map[POOL_UNITS / 32];        // used units bitmap
+  uint32_t nr_free;                     // free units
+} swap_pool_t;
+
+
+
+/* ====== Globals ====== */
+
+swap_slot_t *swap_slots;                // swap entries (entry 0 is SWAP_NONE)
+uint32_t swap_free_slot;                // first free slot (SWAP_NONE: store full)
+swap_pool_t *swap_pool;                 // pages of the store
+uint32_t swap_pool_pages;               // allocated pages of the store
+
+uint32_t swap_nr_pages;                 // swapped out pages
+uint32_t swap_nr_zero;                  // swapped out zero pages
+uint32_t swap_nr_bytes;                 // compressed bytes in the store
+uint32_t swap_nr_rejected;              // pages that did not compress enough
+
+uint16_t lz_hash[1 << LZ_HASH_BITS];    // last position of each hashed 3 bytes sequence
+uint8_t lz_buf[PAGE_SIZE];              // compression output
+
+
+
+/* ====== PRIVATE swap functions ====== */
+
+// Compress a page
+// ret: compressed size or 0 if it does not fit in max bytes
+//   output: groups of a control byte (bit set: match) and 8 items,
+//   literal: 1 byte, match: 12 bits offset and 4 bits length in 2 bytes
+static uint32_t __lz_compress(const uint8_t *src, uint8_t *dst, uint32_t max)
+{
+    const uint8_t *ip, *ref, *end;
+    uint8_t *op, *ctrl;
+    uint32_t bit, h, off, len;
+
+    ip = src;
+    end = src + PAGE_SIZE;
+    op = dst;
+
+    while (ip < end) {
+        // room for a whole group
+        if (op + 17 > dst + max)
+            return 0;
+
+        ctrl = op++;
+        *ctrl = 0;
+
+        for (bit=0; (bit < 8) && (ip < end); bit++) {
+            if (ip + LZ_MIN_MATCH <= end) {
+                // stale entries are harmless: the match is checked
+                h = LZ_HASH(ip);
+                ref = src + lz_hash[h];
+                lz_hash[h] = ip - src;
+                off = ip - ref;
+
+                if ((ref < ip) && (off <= LZ_MAX_OFFSET) &&
+                    (ref[0] == ip[0]) && (ref[1] == ip[1]) && (ref[2] == ip[2])) {
+                    for (len=LZ_MIN_MATCH; (len < LZ_MAX_MATCH) && (ip + len < end) && (ref[len] == ip[len]); len++)
+                        ;
+
+                    *ctrl |= (1 << bit);
+                    *op++ = off & 0xFF;
+                    *op++ = ((off >> 8) << 4) | (len - LZ_MIN_MATCH);
+                    ip += len;
+                    continue;
+                }
+            }
+
+            *op++ = *ip++;
+        }
+    }
+
+    return op - dst;
+}
+
+
+// Decompress a page
+// ret: false if the data is corrupted
+static bool __lz_decompress(const uint8_t *src, uint32_t len, uint8_t *dst)
+{
+    const uint8_t *ip, *iend;
+    uint8_t *op, *oend;
+    uint32_t ctrl, bit, off, mlen;
+
+    ip = src;
+    iend = src + len;
+    op = dst;
+    oend = dst + PAGE_SIZE;
+
+    while (ip < iend) {
+        ctrl = *ip++;
+
+        for (bit=0; (bit < 8) && (ip < iend); bit++, ctrl >>= 1) {
+            if (ctrl & 1) {
+                if (ip + 2 > iend)
+                    return false;
+
+                off = ip[0] | ((ip[1] >> 4) << 8);
+                mlen = (ip[1] & 0x0F) + LZ_MIN_MATCH;
+                ip += 2;
+
+                if ((off == 0) || (off > (uint32_t)(op - dst)) || (op + mlen > oend))
+                    return false;
+
+                // byte by byte: the match can overlap the output
+                for (; mlen > 0; mlen--, op++)
+                    *op = op[-off];
+            }
+            else {
+                if (op >= oend)
+                    return false;
+                *op++ = *ip++;
+            }
+        }
+    }
+
+    return (op == oend);
+}
+
+
+static bool __is_zero_page(const void *page)
+{
+    const uint32_t *p = page;
+    uint32_t i;
+
+    for (i=0; i<PAGE_SIZE/4; i++) {
+        if (p[i] != 0)
+            return false;
+    }
+
+    return true;
+}
+
+
+// Allocate a table from the buddy allocator (direct mapped)
+static void *__alloc_table(uint32_t size)
+{
+    frame_t *frame;
+    uint32_t order;
+
+    for (order=0; ((uint32_t)PAGE_SIZE << order) < size; order++)
+        ;
+
+    frame = mem__alloc_pages(order, ALLOC_NORMAL);
+    if (frame == NULL)
+        return NULL;
+
+    return FRAME_TO_VIRT(frame);
+}
+
+
+// Add a page to the store
+// ret: false if out of memory or the store is full
+static bool __pool_grow(void)
+{
+    frame_t *frame;
+    uint32_t i;
+
+    for (i=0; (i < SWAP_POOL_PAGES) && (swap_pool[i].page != NULL); i++)
+        ;
+    if (i == SWAP_POOL_PAGES)
+        return false;
+
+    frame = mem__alloc_pages(0, ALLOC_NORMAL);
+    if (frame == NULL)
+        return false;
+
+    swap_pool[i].page = FRAME_TO_VIRT(frame);
+    memset(swap_pool[i].map, 0, sizeof(swap_pool[i].map));
+    swap_pool[i].nr_free = POOL_UNITS;
+    swap_pool_pages++;
+
+    return true;
+}
+
+
+// Allocate room for len bytes in the store (first fit)
+// ret: handle of the room or false if there is none
+static bool __pool_alloc(uint32_t len, uint32_t *handle)
+{
+    uint32_t i, unit, units;
+
+    units = (len + (1 << SWAP_UNIT_SHIFT) - 1) >> SWAP_UNIT_SHIFT;
+
+    do {
+        for (i=0; i<SWAP_POOL_PAGES; i++) {
+            if ((swap_pool[i].page == NULL) || (swap_pool[i].nr_free < units))
+                continue;
+
+            unit = bitmap_find_free(swap_pool[i].map, 0, POOL_UNITS, units);
+            if (unit == POOL_UNITS)
+                continue;
+
+            bitmap_set(swap_pool[i].map, unit, units);
+            swap_pool[i].nr_free -= units;
+            *handle = POOL_HANDLE(i, unit);
+            return true;
+        }
+    } while (__pool_grow());
+
+    return false;
+}
+
+
+// Free the room of len bytes at handle, empty pages go back to the buddy
+// allocator (but the spare ones)
+static void __pool_free(uint32_t handle, uint32_t len)
+{
+    swap_pool_t *pool;
+    uint32_t units;
+
+    pool = &swap_pool[HANDLE_PAGE(handle)];
+    units = (len + (1 << SWAP_UNIT_SHIFT) - 1) >> SWAP_UNIT_SHIFT;
+
+    bitmap_clear(pool->map, HANDLE_UNIT(handle), units);
+    pool->nr_free += units;
+
+    if ((pool->nr_free == POOL_UNITS) && (HANDLE_PAGE(handle) >= SWAP_POOL_SPARE)) {
+        mem__free_pages(VIRT_TO_FRAME(pool->page), 0);
+        pool->page = NULL;
+        swap_pool_pages--;
+    }
+}
+
+
+
+/* ====== PUBLIC swap functions ====== */
+
+void swap__init(void)
+{
+    uint32_t i;
+
+    swap_free_slot = SWAP_NONE;
+    swap_pool_pages = 0;
+    swap_nr_pages = swap_nr_zero = swap_nr_bytes = swap_nr_rejected = 0;
+
+    swap_slots = __alloc_table(SWAP_MAX_SLOTS * sizeof(swap_slot_t));
+    swap_pool = __alloc_table(SWAP_POOL_PAGES * sizeof(swap_pool_t));
+    KASSERT((swap_slots != NULL) && (swap_pool != NULL));
+
+    // free slots list, in entry order
+    for (i=SWAP_MAX_SLOTS-1; i>0; i--) {
+        swap_slots[i].count = 0;
+        swap_slots[i].handle = swap_free_slot;
+        swap_free_slot = i;
+    }
+
+    for (i=0; i<SWAP_POOL_PAGES; i++)
+        swap_pool[i].page = NULL;
+
+    // the first pages of the store are kept: reclaim can start with no free memory
+    for (i=0; i<SWAP_POOL_SPARE; i++) {
+        if (!__pool_grow())
+            break;
+    }
+}
+
+
+// Compress a page into the store
+// ret: the swap entry of the page or SWAP_NONE (store full or page not compressible)
+uint32_t swap__store(const void *page)
+{
+    uint32_t state;
+    uint32_t entry, len, handle;
+
+    state = int__irqsave();
+
+    entry = swap_free_slot;
+    if (entry == SWAP_NONE) {
+        int__irqrestore(state);
+        return SWAP_NONE;
+    }
+
+    handle = 0;
+    if (__is_zero_page(page)) {
+        len = 0;
+        swap_nr_zero++;
+    }
+    else {
+        len = __lz_compress(page, lz_buf, SWAP_MAX_BLOB);
+        if (len == 0) {
+            swap_nr_rejected++;
+            int__irqrestore(state);
+            return SWAP_NONE;
+        }
+        if (!__pool_alloc(len, &handle)) {
+            int__irqrestore(state);
+            return SWAP_NONE;
+        }
+        memcpy(swap_pool[HANDLE_PAGE(handle)].page + (HANDLE_UNIT(handle) << SWAP_UNIT_SHIFT), lz_buf, len);
+    }
+
+    swap_free_slot = swap_slots[entry].handle;
+    swap_slots[entry].handle = handle;
+    swap_slots[entry].len = len;
+    swap_slots[entry].count = 1;
+
+    swap_nr_pages++;
+    swap_nr_bytes += len;
+
+    int__irqrestore(state);
+    return entry;
+}
+
+
+// Decompress a swapped out page (the entry stays valid)
+// ret: false if the data is corrupted
+bool swap__load(uint32_t entry, void *page)
+{
+    swap_slot_t *slot;
+    uint32_t handle;
+
+    KASSERT((entry != SWAP_NONE) && (entry < SWAP_MAX_SLOTS));
+    slot = &swap_slots[entry];
+    KASSERT(slot->count > 0);
+
+    if (slot->len == 0) {
+        mem__clear_page(page);
+        return true;
+    }
+
+    handle = slot->handle;
+    return __lz_decompress(swap_pool[HANDLE_PAGE(handle)].page + (HANDLE_UNIT(handle) << SWAP_UNIT_SHIFT),
+                           slot->len, page);
+}
+
+
+// Add a page table entry holding a swap entry (address space cloning)
+void swap__dup(uint32_t entry)
+{
+    uint32_t state;
+
+    KASSERT((entry != SWAP_NONE) && (entry < SWAP_MAX_SLOTS));
+
+    state = int__irqsave();
+    KASSERT((swap_slots[entry].count > 0) && (swap_slots[entry].count < 0xFFFF));
+    swap_slots[entry].count++;
+    int__irqrestore(state);
+}
+
+
+// Drop a swap entry, the page leaves the store with its last entry
+void swap__free(uint32_t entry)
+{
+    uint32_t state;
+    swap_slot_t *slot;
+
+    KASSERT((entry != SWAP_NONE) && (entry < SWAP_MAX_SLOTS));
+    slot = &swap_slots[entry];
+
+    state = int__irqsave();
+
+    KASSERT(slot->count > 0);
+    if (--slot->count == 0) {
+        if (slot->len == 0)
+            swap_nr_zero--;
+        else
+            __pool_free(slot->handle, slot->len);
+
+        swap_nr_pages--;
+        swap_nr_bytes -= slot->len;
+
+        slot->handle = swap_free_slot;
+        swap_free_slot = entry;
+    }
+
+    int__irqrestore(state);
+}
+
+
+void swap__dump(void)
+{
+    console__printf("Swap: %d pages (%d zero) in %d Kb, store %d pages, %d rejected\n",
+                    swap_nr_pages, swap_nr_zero, swap_nr_bytes / 1024,
+                    swap_pool_pages, swap_nr_rejected);
+}
@@ -51,6 +51,149 @@ void memcpy(void *dst, const void *src, size_t len)
 }
 
 
+// memcpy for overlapping buffers
+void memmove(void *dst, const void *src, size_t len)
+{
+    uint8_t *d = dst;
+    const uint8_t *s = src;
+
+    if (d <= s) {
+        while (len > 0) {
+            *d++ = *s++;
+            len--;
+        }
+    }
+    else {
+        while (len > 0) {
+            len--;
+            d[len] = s[len];
+        }
+    }
+}
+
+
+int strncmp(const char *s1, const char *s2, size_t n)
+{
+    while ((n > 0) && (*s1 != '\0') && (*s1 == *s2)) {
+        s1++;
+        s2++;
+        n--;
+    }
+
+    if (n == 0)
+        return 0;
+    return (uint8_t)*s1 - (uint8_t)*s2;
+}
+
+
+// Parse a memory size: decimal or 0x hexadecimal, with an optional K, M or G suffix
+// arg2: set to the first char after the size (can be NULL)
+// ret: the size, UINT32_MAX when it does not fit in 32 bits
+uint32_t memparse(const char *str, const char **end)
+{
+    uint32_t val = 0;
+    uint32_t base = 10;
+    uint32_t digit, shift;
+    bool overflow = false;
+
+    if ((str[0] == '0') && ((str[1] == 'x') || (str[1] == 'X'))) {
+        base = 16;
+        str += 2;
+    }
+
+    for (;; str++) {
+        if ((*str >= '0') && (*str <= '9'))
+            digit = *str - '0';
+        else if ((base == 16) && (*str >= 'a') && (*str <= 'f'))
+            digit = *str - 'a' + 10;
+        else if ((base == 16) && (*str >= 'A') && (*str <= 'F'))
+            digit = *str - 'A' + 10;
+        else
+            break;
+        if (val > (UINT32_MAX - digit) / base)
+            overflow = true;
+        val = val * base + digit;
+    }
+
+    switch (*str) {
+    case 'G': case 'g':
+        shift = 30;
+        str++;
+        break;
+    case 'M': case 'm':
+        shift = 20;
+        str++;
+        break;
+    case 'K': case 'k':
+        shift = 10;
+        str++;
+        break;
+    default:
+        shift = 0;
+        break;
+    }
+
+    if (val > (UINT32_MAX >> shift))
+        overflow = true;
+    val <<= shift;
+
+    if (end != NULL)
+        *end = str;
+    return overflow ? UINT32_MAX : val;
+}
+
+
+// Test a bit of a bitmap
+bool bitmap_test(const uint32_t *map, uint32_t bit)
+{
+    return (map[bit / 32] & (1 << (bit % 32))) != 0;
+}
+
+
+// Set the bits [start, start+n) of a bitmap
+void bitmap_set(uint32_t *map, uint32_t start, uint32_t n)
+{
+    for (; n > 0; start++, n--)
+        map[start / 32] |= (1 << (start % 32));
+}
+
+
+// Clear the bits [start, start+n) of a bitmap
+void bitmap_clear(uint32_t *map, uint32_t start, uint32_t n)
+{
+    for (; n > 0; start++, n--)
+        map[start / 32] &= ~(1 << (start % 32));
+}
+
+
+// Look for n clear bits in a row in [from, to)
+// ret: the first bit of the run or to if there is none
+uint32_t bitmap_find_free(const uint32_t *map, uint32_t from, uint32_t to, uint32_t n)
+{
+    uint32_t bit, run;
+
+    run = 0;
+    for (bit=from; bit<to; bit++) {
+        // skip the full words
+        if (((bit % 32) == 0) && (map[bit / 32] == 0xFFFFFFFF) && (bit + 32 <= to)) {
+            run = 0;
+            bit += 31;
+            continue;
+        }
+
+        if (bitmap_test(map, bit)) {
+            run = 0;
+            continue;
+        }
+
+        if (++run == n)
+            return bit + 1 - n;
+    }
+
+    return to;
+}
+
+
 size_t strlen(const char* str)
 {
     size_t ret = 0;
@@ -72,3 +215,111 @@ inline void outb(uint8_t value, uint16_t port)
 {
     asm volatile("outb %0, %1" : : "a" (value), "dN" (port));
 }
+
+
+inline void cpuid(uint32_t leaf, uint32_t *eax, uint32_t *ebx, uint32_t *ecx, uint32_t *edx)
+{
+    asm volatile("cpuid" : "=a" (*eax), "=b" (*ebx), "=c" (*ecx), "=d" (*edx) : "a" (leaf));
+}
+
+
+// check a CPUID leaf 1 EDX feature bit
+bool cpu_has_feature(uint32_t edx_feature)
+{
+    uint32_t eax, ebx, ecx, edx;
+
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    return ((edx & edx_feature) != 0);
+}
+
+
+inline uint32_t read_cr0(void)
+{
+    uint32_t value;
+    asm volatile("mov %%cr0, %0" : "=r" (value));
+    return(value);
+}
+
+
+inline void write_cr0(uint32_t value)
+{
+    asm volatile("mov %0, %%cr0" : : "r" (value) : "memory");
+}
+
+
+inline uint32_t read_cr3(void)
+{
+    uint32_t value;
+    asm volatile("mov %%cr3, %0" : "=r" (value));
+    return(value);
+}
+
+
+inline void write_cr3(uint32_t value)
+{
+    asm volatile("mov %0, %%cr3" : : "r" (value) : "memory");
+}
+
+
+inline uint32_t read_cr4(void)
+{
+    uint32_t value;
+    asm volatile("mov %%cr4, %0" : "=r" (value));
+    return(value);
+}
+
+
+inline void write_cr4(uint32_t value)
+{
+    asm volatile("mov %0, %%cr4" : : "r" (value) : "memory");
+}
+
+
+// read the Time Stamp Counter (cpu cycles)
+inline uint64_t rdtsc(void)
+{
+    uint32_t lo, hi;
+    asm volatile("rdtsc" : "=a" (lo), "=d" (hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+
+inline void rdmsr(uint32_t msr, uint32_t *lo, uint32_t *hi)
+{
+    asm volatile("rdmsr" : "=a" (*lo), "=d" (*hi) : "c" (msr));
+}
+
+
+inline void wrmsr(uint32_t msr, uint32_t lo, uint32_t hi)
+{
+    asm volatile("wrmsr" : : "a" (lo), "d" (hi), "c" (msr) : "memory");
+}
+
+
+// 64 bits by 32 bits division (no libgcc): two 32 bits divl
+uint64_t div64(uint64_t n, uint32_t d)
+{
+    uint32_t hi, lo, rem;
+
+    hi = (uint32_t)(n >> 32);
+    lo = (uint32_t)n;
+
+    // the high word first, its remainder goes in edx so divl can't overflow
+    rem = hi % d;
+    hi = hi / d;
+    asm("divl %2" : "=a" (lo), "=d" (rem) : "rm" (d), "0" (lo), "1" (rem));
+
+    return ((uint64_t)hi << 32) | lo;
+}
+
+
+// index of the highest bit set (0 for 0)
+inline uint32_t ilog2(uint32_t value)
+{
+    uint32_t bit;
+
+    if (value == 0)
+        return 0;
+    asm("bsr %1, %0" : "=r" (bit) : "rm" (value));
+    return bit;
+}
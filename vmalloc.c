@@ -0,0 +1,277 @@
+/*
+ * Copyright (C) 2013 - Simone Rotondo - http://www.piemontewireless.net/
+ * simOS - tiny x86 kernel
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// vmalloc area: virtually contiguous kernel mappings of any frames.
+// Areas are allocated in a bitmap (one bit per page) and followed by an
+// unmapped guard page. Unmapped areas are not flushed from the TLB one
+// page at a time: their addresses are only reused after a global purge,
+// done once VMALLOC_LAZY_MAX pages are waiting or when the area is full.
+
+// standard includes
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// simOS includes
+#include "utils.h"
+#include "kassert.h"
+#include "console.h"
+#include "mem.h"
+#include "int.h"
+#include "vmalloc.h"
+
+
+
+/* ====== Globals ====== */
+
+uint32_t vm_used[VMALLOC_PAGES / 32];   // Reserved pages (guard and lazy pages included)
+uint32_t vm_last[VMALLOC_PAGES / 32];   // Last page (the guard page) of each area
+uint32_t vm_lazy[VMALLOC_PAGES / 32];   // Unmapped pages waiting for the TLB purge
+uint32_t vm_nused;                      // Number of reserved pages
+uint32_t vm_nlazy;                      // Number of lazy pages
+uint32_t vm_next;                       // Where the next search starts (next fit)
+
+
+
+/* ====== PRIVATE vmalloc functions ====== */
+
+// Reserve the addresses of an area of npages pages (plus its guard page)
+// ret: the area address or 0 if the vmalloc area is full
+static uint32_t __area_alloc(uint32_t npages)
+{
+    uint32_t state;
+    uint32_t page;
+    uint32_t total;
+    bool purged;
+
+    total = npages + 1;
+    if ((npages == 0) || (total > VMALLOC_PAGES))
+        return 0;
+
+    state = int__irqsave();
+
+    purged = false;
+    for (;;) {
+        page = bitmap_find_free(vm_used, vm_next, VMALLOC_PAGES, total);
+        if (page == VMALLOC_PAGES)
+            page = bitmap_find_free(vm_used, 0, VMALLOC_PAGES, total);
+        if ((page != VMALLOC_PAGES) || purged || (vm_nlazy == 0))
+            break;
+
+        // the lazy pages may leave room
+        vmalloc__purge();
+        purged = true;
+    }
+
+    if (page == VMALLOC_PAGES) {
+        int__irqrestore(state);
+        return 0;
+    }
+
+    bitmap_set(vm_used, page, total);
+    bitmap_set(vm_last, page + total - 1, 1);
+    vm_nused += total;
+    vm_next = (page + total < VMALLOC_PAGES) ? page + total : 0;
+
+    int__irqrestore(state);
+    return VMALLOC_START + (page << PAGE_SHIFT);
+}
+
+
+// Unmap an area, its addresses are released at the next purge
+// arg2: give the mapped frames back to the buddy allocator
+static void __area_free(uint32_t addr, bool free_frames)
+{
+    uint32_t state;
+    uint32_t page, last, i;
+    pte_t pte;
+
+    page = (addr - VMALLOC_START) >> PAGE_SHIFT;
+    KASSERT((addr >= VMALLOC_START) && (addr < VMALLOC_END));
+    KASSERT((addr & ~PAGE_MASK) == 0);
+    KASSERT(bitmap_test(vm_used, page) && !bitmap_test(vm_lazy, page));
+
+    for (last=page; !bitmap_test(vm_last, last); last++)
+        ;
+
+    for (i=page; i<last; i++) {
+        pte = mem__unmap_page_lazy(VMALLOC_START + (i << PAGE_SHIFT));
+        if (free_frames && (pte & PAGE_PRESENT))
+            mem__free_pages(PHYS_TO_FRAME(pte & PTE_ADDR_MASK), 0);
+    }
+
+    state = int__irqsave();
+
+    bitmap_clear(vm_last, last, 1);
+    bitmap_set(vm_lazy, page, last + 1 - page);
+    vm_nlazy += last + 1 - page;
+
+    if (vm_nlazy >= VMALLOC_LAZY_MAX)
+        vmalloc__purge();
+
+    int__irqrestore(state);
+}
+
+
+
+/* ====== PUBLIC vmalloc functions ====== */
+
+void vmalloc__init(void)
+{
+    uint32_t addr;
+    pte_t *pte;
+
+    memset(vm_used, 0, sizeof(vm_used));
+    memset(vm_last, 0, sizeof(vm_last));
+    memset(vm_lazy, 0, sizeof(vm_lazy));
+    vm_nused = vm_nlazy = vm_next = 0;
+
+    // the page tables are allocated once, they are shared by all the address spaces
+    for (addr=VMALLOC_START; addr<VMALLOC_END; addr+=LPAGE_SIZE) {
+        pte = mem__get_pte(addr, true);
+        KASSERT(pte != NULL);
+    }
+}
+
+
+// Flush the TLB once for all the lazy pages and release their addresses
+void vmalloc__purge(void)
+{
+    uint32_t state;
+    uint32_t i;
+
+    state = int__irqsave();
+
+    if (vm_nlazy > 0) {
+        mem__tlb_flush_global();
+
+        for (i=0; i<VMALLOC_PAGES/32; i++) {
+            vm_used[i] &= ~vm_lazy[i];
+            vm_lazy[i] = 0;
+        }
+        vm_nused -= vm_nlazy;
+        vm_nlazy = 0;
+    }
+
+    int__irqrestore(state);
+}
+
+
+void vmalloc__dump(void)
+{
+    console__printf("vmalloc: %d/%d pages used, %d lazy\n",
+                    vm_nused - vm_nlazy, VMALLOC_PAGES, vm_nlazy);
+}
+
+
+// Map npages frames in a virtually contiguous area
+// arg3: PAGE_* flags of the mapping (PAGE_WRITE, PAGE_PCD...)
+// ret: the area address or NULL if the vmalloc area is full
+void *vmap(frame_t **frames, uint32_t npages, uint32_t flags)
+{
+    uint32_t addr;
+    uint32_t i;
+    bool mapped;
+
+    addr = __area_alloc(npages);
+    if (addr == 0)
+        return NULL;
+
+    // the page tables are preallocated, mapping can't fail
+    for (i=0; i<npages; i++) {
+        mapped = mem__map_page(addr + (i << PAGE_SHIFT), FRAME_TO_PHYS(frames[i]), flags);
+        KASSERT(mapped);
+    }
+
+    return (void *)addr;
+}
+
+
+// Unmap an area mapped with vmap() (the frames are not freed)
+void vunmap(void *addr)
+{
+    __area_free((uint32_t)addr, false);
+}
+
+
+// Allocate a virtually contiguous buffer, its frames can be anywhere (highmem included)
+// ret: the buffer or NULL if out of memory
+void *vmalloc(size_t size)
+{
+    uint32_t addr, npages, i;
+    frame_t *frame;
+    bool mapped;
+
+    npages = ALIGN_PAGE(size) >> PAGE_SHIFT;
+    addr = __area_alloc(npages);
+    if (addr == 0)
+        return NULL;
+
+    for (i=0; i<npages; i++) {
+        frame = mem__alloc_pages(0, ALLOC_HIGHMEM);
+        if (frame == NULL) {
+            __area_free(addr, true);
+            return NULL;
+        }
+
+        mapped = mem__map_page(addr + (i << PAGE_SHIFT), FRAME_TO_PHYS(frame), PAGE_WRITE);
+        KASSERT(mapped);
+    }
+
+    return (void *)addr;
+}
+
+
+// Free a buffer obtained with vmalloc()
+void vfree(void *addr)
+{
+    if (addr != NULL)
+        __area_free((uint32_t)addr, true);
+}
+
+
+// Map a device memory range (uncached)
+// ret: the address of paddr or NULL if the vmalloc area is full
+void *ioremap(phys_addr_t paddr, size_t size)
+{
+    uint32_t addr, offset, npages, i;
+    bool mapped;
+
+    offset = (uint32_t)paddr & ~PAGE_MASK;
+    npages = ALIGN_PAGE(offset + size) >> PAGE_SHIFT;
+
+    addr = __area_alloc(npages);
+    if (addr == 0)
+        return NULL;
+
+    paddr -= offset;
+    for (i=0; i<npages; i++) {
+        mapped = mem__map_page(addr + (i << PAGE_SHIFT), paddr + (i << PAGE_SHIFT),
+                               PAGE_WRITE | PAGE_PCD | PAGE_PWT);
+        KASSERT(mapped);
+    }
+
+    return (void *)(addr + offset);
+}
+
+
+// Unmap a range mapped with ioremap()
+void iounmap(void *addr)
+{
+    __area_free((uint32_t)addr & PAGE_MASK, false);
+}
@@ -0,0 +1,800 @@
+/*
+ * Copyright (C) 2013 - Simone Rotondo - http://www.piemontewireless.net/
+ * simOS - tiny x86 kernel
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// standard includes
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// simOS includes
+#include "utils.h"
+#include "kassert.h"
+#include "console.h"
+#include "mem.h"
+#include "int.h"
+#include "kmem.h"
+#include "vmm.h"
+#include "swap.h"
+#include "utlist.h"
+
+
+
+// fault_next of an area without faults yet (never page aligned)
+#define FAULT_NEXT_NONE 0xFFFFFFFF
+
+
+
+/* ====== Globals ====== */
+
+kmem_cache_t *vma_cache;                // cache of the vma_t structs
+kmem_cache_t *mm_cache;                 // cache of the mm_t structs
+#if CONFIG_PAGING_PAE
+kmem_cache_t *pdpt_cache;               // cache of the PDPTs (32 bytes aligned)
+#endif
+mm_t kernel_mm;                         // address space built at boot
+mm_t *current_mm;                       // address space in CR3
+mm_t *mm_list;                          // all the address spaces
+uint32_t nb_mms;
+
+mm_t *reclaim_mm;                       // reclaim clock hand: address space
+uint32_t reclaim_addr;                  // reclaim clock hand: last page scanned
+bool reclaim_busy;                      // reclaim is running (allocations can't recurse)
+
+
+
+/* ====== PRIVATE vmm functions ====== */
+
+// Page table entry flags for the pages of an area
+static inline uint32_t __vma_page_flags(vma_t *vma)
+{
+    uint32_t flags = 0;
+
+    if (vma->flags & VMA_WRITE)
+        flags |= PAGE_WRITE;
+    if (vma->flags & VMA_USER)
+        flags |= PAGE_USER;
+
+    return flags;
+}
+
+
+// Check the access that caused a fault against the area rights
+static inline bool __vma_access_ok(vma_t *vma, uint32_t error_code)
+{
+    if ((error_code & PF_WRITE) && !(vma->flags & VMA_WRITE))
+        return false;
+    if ((error_code & PF_USER) && !(vma->flags & VMA_USER))
+        return false;
+
+    return true;
+}
+
+
+// Map a zeroed frame at the page of vaddr
+// arg3: 0 or ALLOC_NORECLAIM
+static bool __map_anon_page(vma_t *vma, uint32_t vaddr, uint32_t flags)
+{
+    frame_t *frame;
+
+    frame = mem__alloc_zeroed_highpage(flags);
+    if (frame == NULL)
+        return false;
+
+    if (!mem__map_page(vaddr, FRAME_TO_PHYS(frame), __vma_page_flags(vma))) {
+        mem__free_pages(frame, 0);
+        return false;
+    }
+
+    return true;
+}
+
+
+
+// Map the not present pages of the fault-around window after addr.
+// The window grows while the faults are sequential and shrinks on random ones.
+static void __fault_around(vma_t *vma, uint32_t addr)
+{
+    uint32_t end, vaddr;
+    pte_t *pte;
+
+    if (addr == vma->fault_next) {
+        if (vma->fault_window < VMA_FAULT_WINDOW_MAX)
+            vma->fault_window <<= 1;
+    }
+    else if (vma->fault_next != FAULT_NEXT_NONE) {
+        if (vma->fault_window > VMA_FAULT_WINDOW_MIN)
+            vma->fault_window >>= 1;
+    }
+
+    end = addr + vma->fault_window * PAGE_SIZE;
+    if ((end > vma->end) || (end < addr))
+        end = vma->end;
+
+    for (vaddr=addr+PAGE_SIZE; vaddr<end; vaddr+=PAGE_SIZE) {
+        pte = mem__get_pte(vaddr, false);
+        if ((pte != NULL) && (*pte & (PAGE_PRESENT | PAGE_SWAP)))
+            continue;
+
+        // out of memory is not an error here, the page will fault later
+        // (and these pages are not worth swapping out others)
+        if (!__map_anon_page(vma, vaddr, ALLOC_NORECLAIM))
+            break;
+    }
+
+    vma->fault_next = vaddr;
+}
+
+
+
+// Copy a page in a new frame
+// ret: the new frame or NULL if out of memory
+static frame_t *__copy_page(void *src)
+{
+    frame_t *frame;
+    void *dst;
+
+    frame = mem__alloc_pages(0, ALLOC_HIGHMEM);
+    if (frame == NULL)
+        return NULL;
+
+    dst = mem__kmap(frame);
+    if (dst == NULL) {
+        mem__free_pages(frame, 0);
+        return NULL;
+    }
+
+    memcpy(dst, src, PAGE_SIZE);
+    mem__kunmap(dst);
+
+    return frame;
+}
+
+
+// Resolve a write fault on a copy-on-write page: the last owner takes the
+// page back, the others get a private copy of it
+static bool __cow_fault(uint32_t vaddr)
+{
+    pte_t *pte;
+    pte_t flags;
+    frame_t *frame, *copy;
+
+    pte = mem__get_pte(vaddr, false);
+    if ((pte == NULL) || !(*pte & PAGE_PRESENT) || !(*pte & PAGE_COW))
+        return false;
+
+    frame = PHYS_TO_FRAME(*pte & PTE_ADDR_MASK);
+    flags = (*pte & PAGE_FLAGS & ~PAGE_COW) | PAGE_WRITE;
+
+    if (frame->refcount == 0) {
+        mem__set_pte(pte, (*pte & PTE_ADDR_MASK) | flags);
+    }
+    else {
+        copy = __copy_page((void *)vaddr);
+        if (copy == NULL)
+            return false;
+
+        mem__set_pte(pte, FRAME_TO_PHYS(copy) | flags);
+        mem__page_unref(frame);
+    }
+
+    mem__tlb_flush_page(vaddr);
+    return true;
+}
+
+
+// Share the user pages of a page table with a new address space:
+// writable pages become copy-on-write in both of them
+// arg1: address of the first page of the page table (in the current address space)
+// arg2: the page table of the new address space (mapped with kmap)
+// ret: false if out of memory
+static bool __clone_ptab(uint32_t vaddr, pte_t *dst)
+{
+    pte_t *src;
+    frame_t *frame, *copy;
+    uint32_t i;
+
+    src = mem__get_pte(vaddr, false);
+
+    for (i=0; i<PTRS_PER_PT; i++, vaddr+=PAGE_SIZE) {
+        if (!(src[i] & PAGE_PRESENT)) {
+            if (src[i] & PAGE_SWAP)
+                swap__dup(PTE_TO_SWAP(src[i]));
+            dst[i] = src[i];
+            continue;
+        }
+
+        frame = PHYS_TO_FRAME(src[i] & PTE_ADDR_MASK);
+
+        // too many mappings: the new address space gets its own copy
+        if (!mem__page_ref(frame)) {
+            copy = __copy_page((void *)vaddr);
+            if (copy == NULL) {
+                // the entries set so far are dropped by __free_user_ptabs()
+                memset(&dst[i], 0, (PTRS_PER_PT - i) * sizeof(pte_t));
+                return false;
+            }
+            dst[i] = FRAME_TO_PHYS(copy) | (src[i] & PAGE_FLAGS & ~PAGE_COW);
+            if (src[i] & PAGE_COW)
+                dst[i] |= PAGE_WRITE;
+            continue;
+        }
+
+        if (src[i] & PAGE_WRITE)
+            mem__set_pte(&src[i], (src[i] & ~(pte_t)PAGE_WRITE) | PAGE_COW);
+
+        dst[i] = src[i];
+    }
+
+    return true;
+}
+
+
+// Free the user page tables of an address space and unref their pages
+static void __free_user_ptabs(mm_t *mm)
+{
+    pte_t *ptab;
+    frame_t *frame;
+    uint32_t i, j;
+
+    for (i=0; i<DIRE(KERNEL_VIRT_BASE); i++) {
+        if (!(mm->pgdir[i] & PAGE_PRESENT))
+            continue;
+
+        frame = PHYS_TO_FRAME(mm->pgdir[i] & PTE_ADDR_MASK);
+        ptab = mem__kmap(frame);
+        KASSERT(ptab != NULL);
+
+        for (j=0; j<PTRS_PER_PT; j++) {
+            if (ptab[j] & PAGE_PRESENT)
+                mem__page_unref(PHYS_TO_FRAME(ptab[j] & PTE_ADDR_MASK));
+            else if (ptab[j] & PAGE_SWAP)
+                swap__free(PTE_TO_SWAP(ptab[j]));
+        }
+
+        mem__kunmap(ptab);
+        mem__free_pages(frame, 0);
+        mm->pgdir[i] = 0;
+    }
+}
+
+
+// Free an address space struct and its page directory
+static void __free_mm(mm_t *mm)
+{
+    vma_t *vma, *tmp;
+
+    DL_FOREACH_SAFE(mm->vmas, vma, tmp) {
+        DL_DELETE(mm->vmas, vma);
+        kmem__cache_free(vma_cache, vma);
+    }
+
+    mem__free_pages(VIRT_TO_FRAME(mm->pgdir), PGDIR_ORDER);
+#if CONFIG_PAGING_PAE
+    kmem__cache_free(pdpt_cache, mm->pdpt);
+#endif
+    kmem__cache_free(mm_cache, mm);
+}
+
+
+
+// Bring back a swapped out page
+static bool __swap_in(vma_t *vma, uint32_t vaddr, pte_t *pte)
+{
+    frame_t *frame;
+    uint32_t entry;
+    void *page;
+    bool ok;
+
+    entry = PTE_TO_SWAP(*pte);
+
+    frame = mem__alloc_pages(0, ALLOC_HIGHMEM);
+    if (frame == NULL)
+        return false;
+
+    page = mem__kmap(frame);
+    if (page == NULL) {
+        mem__free_pages(frame, 0);
+        return false;
+    }
+    ok = swap__load(entry, page);
+    mem__kunmap(page);
+
+    if (!ok || !mem__map_page(vaddr, FRAME_TO_PHYS(frame), __vma_page_flags(vma))) {
+        mem__free_pages(frame, 0);
+        return false;
+    }
+
+    swap__free(entry);
+    return true;
+}
+
+
+// Move the reclaim clock hand to the next page of the anonymous areas,
+// the address spaces are scanned one after the other
+// ret: false if there is no anonymous page at all
+static bool __reclaim_next(void)
+{
+    mm_t *mm;
+    vma_t *vma;
+    uint32_t vaddr, n;
+
+    if (reclaim_mm == NULL) {
+        mm = mm_list;
+        vaddr = 0;
+    }
+    else {
+        mm = reclaim_mm;
+        vaddr = reclaim_addr + PAGE_SIZE;
+    }
+
+    for (n=0; n<=nb_mms; n++) {
+        DL_FOREACH(mm->vmas, vma) {
+            if ((vma->flags & VMA_ANON) && (vaddr < vma->end)) {
+                reclaim_mm = mm;
+                reclaim_addr = (vaddr > vma->start) ? vaddr : vma->start;
+                return true;
+            }
+        }
+
+        mm = (mm->next != NULL) ? mm->next : mm_list;
+        vaddr = 0;
+    }
+
+    return false;
+}
+
+
+// Try to swap out the page at vaddr of an address space (second chance:
+// the recently accessed pages only lose their accessed bit)
+// arg3: highest zone of the frames worth freeing (ZONE_*)
+// ret: true if the frame has been freed
+static bool __swap_out(mm_t *mm, uint32_t vaddr, uint32_t zone)
+{
+    pte_t *ptab, *pte;
+    frame_t *frame;
+    uint32_t entry;
+    void *page;
+    bool ret;
+
+    if (!(mm->pgdir[DIRE(vaddr)] & PAGE_PRESENT) || (mm->pgdir[DIRE(vaddr)] & PAGE_LARGE))
+        return false;
+
+    // the address space is not always the current one, no self map
+    ptab = mem__kmap(PHYS_TO_FRAME(mm->pgdir[DIRE(vaddr)] & PTE_ADDR_MASK));
+    if (ptab == NULL)
+        return false;
+
+    pte = &ptab[GET_PT(vaddr)];
+    ret = false;
+
+    if (!(*pte & PAGE_PRESENT))
+        goto out;
+
+    // the frame can't serve the allocation: leave the page alone
+    frame = PHYS_TO_FRAME(*pte & PTE_ADDR_MASK);
+    if (mem__frame_zone(frame) > zone)
+        goto out;
+
+    if (*pte & PAGE_ACCESSED) {
+        mem__set_pte(pte, *pte & ~(pte_t)PAGE_ACCESSED);
+        if (mm == current_mm)
+            mem__tlb_flush_page(vaddr);
+        goto out;
+    }
+
+    // shared copy-on-write pages would need all their mappings
+    if (frame->refcount != 0)
+        goto out;
+
+    page = mem__kmap(frame);
+    if (page == NULL)
+        goto out;
+    entry = swap__store(page);
+    mem__kunmap(page);
+
+    if (entry == SWAP_NONE)
+        goto out;
+
+    mem__set_pte(pte, SWAP_TO_PTE(entry));
+    if (mm == current_mm)
+        mem__tlb_flush_page(vaddr);
+    mem__free_pages(frame, 0);
+    ret = true;
+
+out:
+    mem__kunmap(ptab);
+    return ret;
+}
+
+
+
+/* ====== PUBLIC vmm functions ====== */
+
+void vmm__init(void)
+{
+    kernel_mm.pgdir = kpage_dir;
+    kernel_mm.pdpt = NULL;
+    kernel_mm.cr3 = read_cr3();
+    kernel_mm.vmas = NULL;
+    kernel_mm.vma_last = NULL;
+    current_mm = &kernel_mm;
+
+    mm_list = NULL;
+    DL_APPEND(mm_list, &kernel_mm);
+    nb_mms = 1;
+    reclaim_mm = NULL;
+    reclaim_busy = false;
+
+    vma_cache = kmem__cache_create("vma", sizeof(vma_t), 0);
+    KASSERT(vma_cache != NULL);
+    mm_cache = kmem__cache_create("mm", sizeof(mm_t), 0);
+    KASSERT(mm_cache != NULL);
+#if CONFIG_PAGING_PAE
+    pdpt_cache = kmem__cache_create("pdpt", PDPT_ENTRIES * sizeof(uint64_t), KMEM_HWCACHE_ALIGN);
+    KASSERT(pdpt_cache != NULL);
+#endif
+}
+
+
+// Register a virtual memory area, its pages are mapped on the first access
+// ret: the new area or NULL (overlap with another area, the NULL page or the kernel space, out of memory)
+vma_t *vmm__area_create(uint32_t start, uint32_t len, uint32_t flags)
+{
+    vma_t *vma, *elt;
+    uint32_t state;
+    uint32_t end;
+
+    start &= PAGE_MASK;
+    end = ALIGN_PAGE(start + len);
+    if ((len == 0) || (end <= start))
+        return NULL;
+
+    // the first page stays unmapped so that NULL dereferences fault
+    if (start < PAGE_SIZE)
+        return NULL;
+
+    // the kernel space is made of the direct map, vmalloc, kmap and the page tables self map
+    if (end > KERNEL_VIRT_BASE)
+        return NULL;
+
+    vma = kmem__cache_alloc(vma_cache);
+    if (vma == NULL)
+        return NULL;
+
+    vma->start = start;
+    vma->end = end;
+    vma->flags = flags;
+    vma->fault_window = VMA_FAULT_WINDOW;
+    vma->fault_next = FAULT_NEXT_NONE;
+
+    state = int__irqsave();
+
+    // keep the list sorted and without overlaps
+    DL_FOREACH(current_mm->vmas, elt) {
+        if (elt->end <= start)
+            continue;
+        if (elt->start < end) {
+            int__irqrestore(state);
+            kmem__cache_free(vma_cache, vma);
+            return NULL;
+        }
+        break;
+    }
+
+    if (elt == NULL) {
+        DL_APPEND(current_mm->vmas, vma);
+    }
+    else if (elt == current_mm->vmas) {
+        DL_PREPEND(current_mm->vmas, vma);
+    }
+    else {
+        vma->prev = elt->prev;
+        vma->next = elt;
+        elt->prev->next = vma;
+        elt->prev = vma;
+    }
+
+    int__irqrestore(state);
+    return vma;
+}
+
+
+// Unregister an area and free the frames mapped in it
+void vmm__area_destroy(vma_t *vma)
+{
+    uint32_t state;
+    uint32_t vaddr;
+    pte_t pte;
+
+    state = int__irqsave();
+
+    DL_DELETE(current_mm->vmas, vma);
+    if (current_mm->vma_last == vma)
+        current_mm->vma_last = NULL;
+
+    for (vaddr=vma->start; vaddr<vma->end; vaddr+=PAGE_SIZE) {
+        pte = mem__unmap_page(vaddr);
+        if (pte & PAGE_PRESENT)
+            mem__page_unref(PHYS_TO_FRAME(pte & PTE_ADDR_MASK));
+        else if (pte & PAGE_SWAP)
+            swap__free(PTE_TO_SWAP(pte));
+    }
+
+    int__irqrestore(state);
+
+    kmem__cache_free(vma_cache, vma);
+}
+
+
+// Set the fault-around window of an area (only used with VMA_FAULTAROUND)
+void vmm__area_set_window(vma_t *vma, uint32_t npages)
+{
+    if (npages < VMA_FAULT_WINDOW_MIN)
+        npages = VMA_FAULT_WINDOW_MIN;
+    if (npages > VMA_FAULT_WINDOW_MAX)
+        npages = VMA_FAULT_WINDOW_MAX;
+
+    vma->fault_window = npages;
+}
+
+
+// Find the area containing addr
+// ret: the area or NULL
+vma_t *vmm__find_area(uint32_t addr)
+{
+    vma_t *vma;
+
+    // faults tend to hit the same area again
+    vma = current_mm->vma_last;
+    if ((vma != NULL) && (addr >= vma->start) && (addr < vma->end))
+        return vma;
+
+    DL_FOREACH(current_mm->vmas, vma) {
+        if (addr < vma->start)
+            return NULL;
+        if (addr < vma->end) {
+            current_mm->vma_last = vma;
+            return vma;
+        }
+    }
+
+    return NULL;
+}
+
+
+// Resolve a page fault (called from isr_pagefault with interrupts disabled)
+// ret: true when the faulting access can be restarted
+bool vmm__handle_fault(uint32_t addr, uint32_t error_code)
+{
+    vma_t *vma;
+    pte_t *pte;
+
+    if (error_code & PF_RSVD)
+        return false;
+
+    vma = vmm__find_area(addr);
+    if ((vma == NULL) || !__vma_access_ok(vma, error_code))
+        return false;
+
+    // write on a present page: only copy-on-write pages can be fixed
+    if (error_code & PF_PROT)
+        return (error_code & PF_WRITE) && __cow_fault(addr & PAGE_MASK);
+
+    // only anonymous not present pages can be filled in
+    if (!(vma->flags & VMA_ANON))
+        return false;
+
+    addr &= PAGE_MASK;
+    pte = mem__get_pte(addr, false);
+    if ((pte != NULL) && (*pte & PAGE_SWAP))
+        return __swap_in(vma, addr, pte);
+
+    if (!__map_anon_page(vma, addr, 0))
+        return false;
+
+    if (vma->flags & VMA_FAULTAROUND)
+        __fault_around(vma, addr);
+
+    return true;
+}
+
+
+// Clone the current address space: the user pages are shared copy-on-write,
+// the kernel part of the page directory is copied (the kernel page tables
+// are all allocated at boot, so they are the same for everyone)
+// ret: the new address space or NULL if out of memory
+mm_t *vmm__mm_clone(void)
+{
+    mm_t *mm;
+    vma_t *vma, *elt;
+    frame_t *frame;
+    pte_t *pde, *ptab;
+    uint32_t i;
+    bool ok;
+
+    mm = kmem__cache_alloc(mm_cache);
+    if (mm == NULL)
+        return NULL;
+
+    frame = mem__alloc_pages(PGDIR_ORDER, ALLOC_NORMAL);
+    if (frame == NULL) {
+        kmem__cache_free(mm_cache, mm);
+        return NULL;
+    }
+
+    mm->pgdir = FRAME_TO_VIRT(frame);
+    mm->vmas = NULL;
+    mm->vma_last = NULL;
+
+#if CONFIG_PAGING_PAE
+    mm->pdpt = kmem__cache_alloc(pdpt_cache);
+    if (mm->pdpt == NULL) {
+        mem__free_pages(frame, PGDIR_ORDER);
+        kmem__cache_free(mm_cache, mm);
+        return NULL;
+    }
+    for (i=0; i<PDPT_ENTRIES; i++)
+        ((uint64_t *)mm->pdpt)[i] = (FRAME_TO_PHYS(frame) + i * PAGE_SIZE) | PAGE_PRESENT;
+    mm->cr3 = VIRT_TO_PHYS(mm->pdpt);
+#else
+    mm->pdpt = NULL;
+    mm->cr3 = VIRT_TO_PHYS(mm->pgdir);
+#endif
+
+    // kernel part and self map
+    pde = PDE_VIRT(0);
+    for (i=DIRE(KERNEL_VIRT_BASE); i<PTRS_PER_PD; i++)
+        mm->pgdir[i] = pde[i];
+    for (i=0; i<PTRS_PER_PD/PTRS_PER_PT; i++)
+        mm->pgdir[SELFMAP_PDE + i] = (FRAME_TO_PHYS(frame) + i * PAGE_SIZE) | PAGE_WRITE | PAGE_PRESENT;
+
+    // user part: a new page table for each one of the current address space
+    ok = true;
+    for (i=0; i<DIRE(KERNEL_VIRT_BASE); i++) {
+        mm->pgdir[i] = 0;
+        if (!ok || !(pde[i] & PAGE_PRESENT))
+            continue;
+
+        frame = mem__alloc_pages(0, ALLOC_HIGHMEM);
+        ptab = (frame != NULL) ? mem__kmap(frame) : NULL;
+        if (ptab == NULL) {
+            if (frame != NULL)
+                mem__free_pages(frame, 0);
+            ok = false;
+            continue;
+        }
+
+        mm->pgdir[i] = FRAME_TO_PHYS(frame) | (pde[i] & PAGE_FLAGS);
+        ok = __clone_ptab(i << LPAGE_SHIFT, ptab);
+        mem__kunmap(ptab);
+    }
+
+    // the pages that became read-only must fault now
+    mem__tlb_flush();
+
+    DL_FOREACH(current_mm->vmas, elt) {
+        if (!ok)
+            break;
+
+        vma = kmem__cache_alloc(vma_cache);
+        if (vma == NULL) {
+            ok = false;
+            break;
+        }
+        *vma = *elt;
+        DL_APPEND(mm->vmas, vma);
+    }
+
+    if (!ok) {
+        __free_user_ptabs(mm);
+        __free_mm(mm);
+        return NULL;
+    }
+
+    DL_APPEND(mm_list, mm);
+    nb_mms++;
+
+    return mm;
+}
+
+
+// Make an address space the current one
+void vmm__mm_switch(mm_t *mm)
+{
+    uint32_t state;
+
+    state = int__irqsave();
+    current_mm = mm;
+    write_cr3(mm->cr3);
+    int__irqrestore(state);
+}
+
+
+// Free an address space and its pages (it can't be the current one)
+void vmm__mm_destroy(mm_t *mm)
+{
+    KASSERT((mm != current_mm) && (mm != &kernel_mm));
+
+    DL_DELETE(mm_list, mm);
+    nb_mms--;
+    if (reclaim_mm == mm)
+        reclaim_mm = NULL;
+
+    __free_user_ptabs(mm);
+    __free_mm(mm);
+}
+
+
+// Free frames by compressing anonymous pages into the swap store
+// (called by mem__alloc_pages() when it runs out of memory)
+// arg2: highest zone of the frames to free (ZONE_*), the allocation can't use the others
+// ret: number of freed frames
+uint32_t vmm__reclaim(uint32_t npages, uint32_t zone)
+{
+    uint32_t state;
+    uint32_t freed, scan;
+    mm_t *mm;
+    vma_t *vma;
+    bool more;
+
+    state = int__irqsave();
+    if (reclaim_busy || (mm_list == NULL)) {
+        int__irqrestore(state);
+        return 0;
+    }
+    reclaim_busy = true;
+
+    if (npages < SWAP_RECLAIM_BATCH)
+        npages = SWAP_RECLAIM_BATCH;
+
+    // two rounds at most: the first one can only clear the accessed bits
+    scan = 0;
+    DL_FOREACH(mm_list, mm) {
+        DL_FOREACH(mm->vmas, vma) {
+            if (vma->flags & VMA_ANON)
+                scan += 2 * ((vma->end - vma->start) / PAGE_SIZE);
+        }
+    }
+
+    int__irqrestore(state);
+
+    // one page at a time: the interrupts are not held off for the whole batch
+    freed = 0;
+    for (more = true; more && (scan > 0) && (freed < npages); scan--) {
+        state = int__irqsave();
+        more = __reclaim_next();
+        if (more && __swap_out(reclaim_mm, reclaim_addr, zone))
+            freed++;
+        int__irqrestore(state);
+    }
+
+    reclaim_busy = false;
+
+    return freed;
+}
+
+
+void vmm__dump_areas(void)
+{
+    vma_t *vma;
+
+    console__printf("Virtual memory areas:\n");
+    DL_FOREACH(current_mm->vmas, vma) {
+        console__printf("0x%x - 0x%x flags=0x%x\n", vma->start, vma->end, vma->flags);
+    }
+}